@@ -0,0 +1,18 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// Microbenchmarks del pipeline. Se ejecutan desde el estado INIT cuando
+// BENCH_ENABLE está a 1 en config.h, tanto en el ESP32 como en el target
+// linux (idf.py --preview set-target linux), y vuelcan los resultados por log.
+
+// Coste y precisión de la conversión LSB -> °C (fórmula, tabla float y tabla en punto fijo)
+void bench_lut(void);
+
+// Rendimiento del transporte entre tareas: RingbufHandle_t frente a la cola SPSC,
+// con el productor en el núcleo 0 y el consumidor en el 1, como en el pipeline
+void bench_canal(void);
+
+// Ejecuta todos los benchmarks
+void bench_run(void);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __CALIBRACION_H__
+#define __CALIBRACION_H__
+
+// Calibración por canal. Cada termistor tiene sus coeficientes Steinhart–Hart
+// (1/T = a + b ln R + c ln³ R), guardados en NVS; sin calibrar se usan unos
+// equivalentes a la ecuación Beta con los valores nominales de config.h. La
+// tensión sale de la calibración del ADC grabada en eFuse (adc_cali, por
+// ajuste de curva o de recta según el chip y con la atenuación de term.c) en
+// lugar de la recta 3.3 V / 4095, que ignora la no linealidad del ADC.
+//
+// En calib_init se precalcula una tabla por canal con la temperatura en
+// centésimas de grado para cada valor del ADC: en el camino caliente cada
+// muestra cuesta un acceso a la tabla. Ocupa THERM_NUM * 8 KB.
+// En el target linux no hay eFuse: se usa la recta, como el backend simulado.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+#include "config.h"
+
+// Tensión de alimentación del divisor (mV)
+#define CALIB_VCC_MV 3300
+
+typedef struct
+{
+	float a;
+	float b;
+	float c;
+	float r_serie; // resistencia fija del divisor (ohm)
+}calib_sh_t;
+
+// Origen de la tensión usada para la tabla de cada canal
+typedef enum
+{
+	CALIB_ADC_RECTA_NOMINAL, // lsb * VCC / 4095, sin calibración de fábrica
+	CALIB_ADC_LINEA,         // adc_cali por ajuste de recta (eFuse)
+	CALIB_ADC_CURVA          // adc_cali por ajuste de curva (eFuse)
+}calib_adc_t;
+
+extern int16_t calib_lut[THERM_NUM][THERM_LUT_SIZE];
+
+// Lee los coeficientes de NVS (ya inicializada), crea la calibración del ADC de
+// cada canal y construye las tablas. channels en el orden de mensaje.lsb[].
+esp_err_t calib_init(const therm_chan_t *channels, size_t n);
+
+// Coeficientes equivalentes a la ecuación Beta
+calib_sh_t calib_sh_beta(float beta, float r0, float t0_k);
+// Guarda en NVS los coeficientes de un canal y, si se han guardado, los aplica
+// rehaciendo su tabla; si falla la escritura el canal sigue como estaba
+esp_err_t calib_set(int canal, const calib_sh_t *sh);
+calib_sh_t calib_get(int canal);
+calib_adc_t calib_adc(int canal);
+void calib_volcar(void);
+
+// Temperatura del canal en centésimas de grado: un acceso a la tabla
+static inline int16_t calib_cdeg(int canal, uint16_t lsb)
+{
+	return calib_lut[canal][lsb & THERM_LSB_MAX];
+}
+
+static inline float calib_t(int canal, uint16_t lsb)
+{
+	return calib_cdeg(canal, lsb) / 100.0f;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef __CANAL_H__
+#define __CANAL_H__
+
+// Canal entre dos tareas del pipeline. Recubre el buffer cíclico de ESP-IDF o
+// la cola SPSC (spsc.h) con la misma semántica de reserva/publicación y
+// recepción/devolución, de modo que las tareas no dependen del tipo elegido
+// en main.c. Las funciones son inline: el coste es una comparación.
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+
+#include "spsc.h"
+
+typedef enum
+{
+	CANAL_RINGBUF, // RingbufHandle_t (NOSPLIT), con cerrojo en cada operación
+	CANAL_SPSC     // spsc_t, sin cerrojos, solo un productor y un consumidor
+}canal_tipo_t;
+
+typedef struct
+{
+	canal_tipo_t tipo;
+	RingbufHandle_t rbuf;
+	spsc_t *spsc;
+	size_t capacidad; // bytes, para los informes de ocupación
+}canal_t;
+
+static inline void canal_init_ringbuf(canal_t *c, RingbufHandle_t rbuf)
+{
+	c->tipo = CANAL_RINGBUF;
+	c->rbuf = rbuf;
+	c->spsc = NULL;
+	c->capacidad = xRingbufferGetCurFreeSize(rbuf); // vacío: todo el buffer
+}
+
+static inline void canal_init_spsc(canal_t *c, spsc_t *spsc)
+{
+	c->tipo = CANAL_SPSC;
+	c->rbuf = NULL;
+	c->spsc = spsc;
+	c->capacidad = spsc->nslots * spsc->slot_size;
+}
+
+// Reserva espacio para escribir size bytes (ver xRingbufferSendAcquire)
+static inline BaseType_t canal_send_acquire(canal_t *c, void **ptr, size_t size, TickType_t timeout)
+{
+	if (c->tipo == CANAL_SPSC)
+	{
+		*ptr = spsc_acquire(c->spsc, size, timeout);
+		return (*ptr != NULL) ? pdTRUE : pdFALSE;
+	}
+	return xRingbufferSendAcquire(c->rbuf, ptr, size, timeout);
+}
+
+// Publica lo escrito en el espacio reservado
+static inline void canal_send_complete(canal_t *c, void *ptr)
+{
+	if (c->tipo == CANAL_SPSC)
+	{
+		spsc_commit(c->spsc, ptr);
+		return;
+	}
+	xRingbufferSendComplete(c->rbuf, ptr);
+}
+
+// Espera un elemento; NULL si vence el timeout (ver xRingbufferReceive) o si
+// se despierta al consumidor (canal_despertar)
+static inline void *canal_receive(canal_t *c, size_t *len, TickType_t timeout)
+{
+	if (c->tipo == CANAL_SPSC)
+	{
+		return spsc_receive(c->spsc, len, timeout);
+	}
+	void *ptr = xRingbufferReceive(c->rbuf, len, timeout);
+	// Centinela de canal_despertar: los bloques de datos nunca están vacíos
+	if (ptr != NULL && *len == 0)
+	{
+		vRingbufferReturnItem(c->rbuf, ptr);
+		return NULL;
+	}
+	return ptr;
+}
+
+// Devuelve el elemento recibido
+static inline void canal_return(canal_t *c, void *ptr)
+{
+	if (c->tipo == CANAL_SPSC)
+	{
+		spsc_release(c->spsc, ptr);
+		return;
+	}
+	vRingbufferReturnItem(c->rbuf, ptr);
+}
+
+// Despierta al consumidor bloqueado en canal_receive, que devuelve NULL (firma
+// de system_task_wake_t, ver system.h). En el buffer cíclico se publica un
+// elemento vacío como centinela; si no cabe, el consumidor no está bloqueado.
+static inline void canal_despertar(void *ctx)
+{
+	canal_t *c = (canal_t *) ctx;
+	if (c->tipo == CANAL_SPSC)
+	{
+		spsc_cerrar(c->spsc);
+		return;
+	}
+	static const uint8_t centinela = 0;
+	xRingbufferSend(c->rbuf, &centinela, 0, 0);
+}
+
+// Espacio libre, en bytes, para diagnóstico
+static inline size_t canal_free(canal_t *c)
+{
+	if (c->tipo == CANAL_SPSC)
+	{
+		return (c->spsc->nslots - spsc_count(c->spsc)) * c->spsc->slot_size;
+	}
+	return xRingbufferGetCurFreeSize(c->rbuf);
+}
+
+// Ocupación en bytes y capacidad (firma de system_queue_level_t, ver system.h)
+static inline size_t canal_ocupacion(void *ctx, size_t *capacidad)
+{
+	canal_t *c = (canal_t *) ctx;
+	size_t libre = canal_free(c);
+	*capacidad = c->capacidad;
+	return (libre < c->capacidad) ? c->capacidad - libre : 0;
+}
+
+#endif
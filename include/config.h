@@ -18,11 +18,11 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/ringbuf.h>
 
-// esp
-#include <hal/adc_types.h>
-
 // propias
 #include "system.h"
+#include "term.h" // tipos del ADC (o sus equivalentes en el target linux)
+#include "canal.h"
+#include "filtro.h"
 
 // Abstracciones para facilitar la legibilidad
 #define CORE0 0
@@ -32,13 +32,13 @@
 
 // Nombre y estados de la máquina
 #define SYS_NAME "STF P1 System"
+// Un único estado de fallo parcial para cualquier número de sensores: qué
+// sensores han fallado lo dice el mapa de votador_sensores_fallidos()
 enum{
 	INIT,
     SENSOR_LOOP,
-	SENSOR1_FAILURE,
-	SENSOR2_FAILURE,
-	SENSOR3_FAILURE,
-	TOTAL_FAILURE
+	SENSOR_FAILURE,   // algún sensor discrepa, pero todos los grupos conservan mayoría
+	TOTAL_FAILURE     // algún grupo se ha quedado sin mayoría
 };
 
 // Configuración del termistor
@@ -50,33 +50,170 @@ enum{
 #define NOMINAL_TEMPERATURE 298.15    // 25°C en Kelvin
 #define BETA_COEFFICIENT 3950         // Constante B (ajustar según el termistor)
 
+// Redundancia N-modular: GRUPOS puntos de medida, cada uno con SENSORES_GRUPO
+// termistores que miden lo mismo y se votan entre sí (mayoría o mediana de N).
+// Los canales se numeran grupo a grupo: el sensor s del grupo g es el canal
+// g * SENSORES_GRUPO + s, tanto en THERM_CANALES como en mensaje.lsb[].
+#define SENSORES_GRUPO 3
+#define GRUPOS 1
+#define THERM_NUM (SENSORES_GRUPO * GRUPOS)
+// Sensores que deben coincidir para que un grupo tenga mayoría
+#define VOTADOR_MAYORIA (SENSORES_GRUPO / 2 + 1)
+
+// Tabla de canales {unidad, canal}, en el orden anterior. Conviene repartir
+// los sensores de cada grupo entre ADC_UNIT_1 y ADC_UNIT_2 para que un fallo de
+// una unidad no tumbe un grupo entero (ADC2 no está disponible con WiFi activa;
+// el modo continuo solo admite ADC_UNIT_1). Por ejemplo, dos grupos de tres:
+//   {{ADC_UNIT_1, ADC_CHANNEL_6}, {ADC_UNIT_2, ADC_CHANNEL_4}, {ADC_UNIT_1, ADC_CHANNEL_0},
+//    {ADC_UNIT_2, ADC_CHANNEL_5}, {ADC_UNIT_1, ADC_CHANNEL_7}, {ADC_UNIT_2, ADC_CHANNEL_6}}
+// Por defecto, un grupo de tres en ADC1 (GPIO34, GPIO33, GPIO36)
+#define THERM_CANALES {{ADC_UNIT_1, ADC_CHANNEL_6}, {ADC_UNIT_1, ADC_CHANNEL_5}, {ADC_UNIT_1, ADC_CHANNEL_0}}
+
+_Static_assert(SENSORES_GRUPO >= 3, "hacen falta al menos tres sensores por grupo para votar");
+_Static_assert(THERM_NUM <= 32, "el mapa de fallos tiene un bit por sensor");
+_Static_assert(THERM_NUM <= FILTRO_MAX_CANALES, "el filtro del sensor no admite tantos canales");
+
+// Mapa de sensores (bit c = canal c) del tamaño justo para THERM_NUM
+#if THERM_NUM <= 8
+typedef uint8_t therm_mapa_t;
+#elif THERM_NUM <= 16
+typedef uint16_t therm_mapa_t;
+#else
+typedef uint32_t therm_mapa_t;
+#endif
+
+// Periodo de muestreo del sensor en modo oneshot (ns). Lo marca un gptimer
+// (ver muestreo.h), de modo que admite kHz: 1000000 = 1 kHz, 50000 = 20 kHz.
+// Mínimo MUESTREO_PERIODO_MIN_NS.
+#define SENSOR_PERIODO_NS 1000000000u
+
+// Modo de adquisición del sensor: SENSOR_ACQ_ONESHOT (una lectura por canal en
+// cada tick del temporizador), SENSOR_ACQ_ENTRELAZADO (como oneshot, pero dos
+// lecturas por canal en orden espejo ABC-CBA para alinear los canales en el
+// tiempo, ver therm_read_aligned) o SENSOR_ACQ_CONTINUOUS (ADC continuo por DMA).
+// En modo continuo la frecuencia es de conversiones/s sumando todos los canales.
+#define SENSOR_ACQ SENSOR_ACQ_ONESHOT
+// Modo entrelazado: interpola cada canal al instante común antes de votar
+#define SENSOR_INTERPOLAR 1
+#define SENSOR_CONT_FREQ_HZ 20000
+
+// Filtro del sensor (filtro.h): FILTRO_NINGUNO, FILTRO_MEDIA, FILTRO_IIR o
+// FILTRO_MEDIANA sobre una ventana de SENSOR_FILTRO_K muestras por canal. Se
+// publica una muestra de cada SENSOR_DECIMACION adquiridas, de modo que el
+// ritmo hacia el votador es la frecuencia de adquisición / SENSOR_DECIMACION.
+#define SENSOR_FILTRO FILTRO_NINGUNO
+#define SENSOR_FILTRO_K 8
+#define SENSOR_FILTRO_SHIFT 3
+#define SENSOR_DECIMACION 1
+
+// Mensajes por bloque entre sensor, votador y monitor. Cada bloque es un único
+// elemento del buffer cíclico, así que el coste de reserva/liberación y el
+// despertar de la tarea consumidora se pagan una vez por bloque y no por muestra.
+#define MSG_BATCH_MAX 32
+#define SENSOR_BATCH 1
+#define VOTADOR_BATCH MSG_BATCH_MAX
+
+// Backend de adquisición (ver term.h). En el target linux siempre se simula;
+// con THERM_SIMULADO a 1 también se simula en el ESP32, sin termistores.
+// Si THERM_SIM_TRAZA no se puede abrir se usa una señal sintética.
+#define THERM_SIMULADO 0
+#define THERM_SIM_TRAZA "traza.csv"
+
+// Microbenchmarks (bench.h) al arrancar, antes de lanzar las tareas
+#define BENCH_ENABLE 0
+
 #define THERM_MASK 0x0000 // Mascara para aplicar a las lecturas
 
+// Modo de voto (ver votador.h), grupo a grupo: VOTADOR_MODO_BITS (mayoría bit a
+// bit bajo THERM_MASK) o VOTADOR_MODO_ANALOGICO (mediana del grupo y ventana de
+// tolerancia: un sensor que no está a menos de VOTADOR_TOL de al menos
+// VOTADOR_MAYORIA - 1 de los otros se excluye de la media). La tolerancia va en
+// LSB o en centésimas de grado según VOTADOR_TOL_UNIDAD.
+#define VOTADOR_MODO VOTADOR_MODO_ANALOGICO
+#define VOTADOR_TOL_UNIDAD VOTADOR_TOL_CDEG
+#define VOTADOR_TOL 200 // 2 °C
+// Muestras consecutivas con el mismo fallo antes de pedir el cambio de estado
+#define VOTADOR_HISTERESIS 3
+
 // Configuración del buffer cíclico
 #define BUFFER_SIZE  2048
 #define BUFFER_TYPE  RINGBUF_TYPE_NOSPLIT
 
+// Transporte entre tareas (ver canal.h): CANAL_RINGBUF usa el buffer cíclico de
+// ESP-IDF; CANAL_SPSC una cola sin cerrojos estática de SPSC_SLOTS huecos, cada
+// uno con capacidad para un bloque completo de MSG_BATCH_MAX mensajes.
+#define CANAL_TIPO CANAL_RINGBUF
+#define SPSC_SLOTS 16
+
+// Reserva de memoria de las tareas del pipeline y del registro, de los buffers
+// cíclicos y de sus colas: estática (1), con el tamaño fijado aquí y el consumo
+// conocido en compilación (main.c lo resume al arrancar), o desde el heap (0).
+#define MEMORIA_ESTATICA 1
+
 // Configuracion de envio de mensajes
 
 #define ID_SENSOR 0
 #define ID_VOTADOR 1
 
+// Salida del monitor: cada MONITOR_VENTANA_MS se muestra una línea con el número
+// de muestras, mínimo, máximo, media y desviación de cada termistor y de la media
+// votada. Las muestras individuales (MONITOR_LOG_MUESTRAS) se limitan a una cada
+// MONITOR_LOG_MS, de modo que el puerto serie no frena al monitor a kHz.
+#define MONITOR_VENTANA_MS 1000
+#define MONITOR_LOG_MUESTRAS 1
+#define MONITOR_LOG_MS 1000
+
+// Telemetría binaria (telemetria.h): el monitor envía cada muestra votada en
+// tramas COBS con CRC por la UART de la consola (en linux, a TELEMETRIA_FICHERO).
+// Conviene desactivar MONITOR_LOG_MUESTRAS para no mezclar texto y tramas; el
+// decodificador descarta lo que no sea una trama válida.
+#define TELEMETRIA_ENABLE 0
+#define TELEMETRIA_CLAVE 64 // un registro absoluto cada 64
+#define TELEMETRIA_BUF 512  // bytes acumulados antes de escribir
+#define TELEMETRIA_UART CONFIG_ESP_CONSOLE_UART_NUM
+#define TELEMETRIA_FICHERO "telemetria.bin"
+
+// Registro circular de muestras en flash (registro.h), en la partición
+// "registro" de partitions.csv. Las muestras se vuelcan por páginas de 256 bytes
+// y como mucho quedan REGISTRO_FLUSH_MS sin escribir.
+#define REGISTRO_ENABLE 1
+#define REGISTRO_SUBTIPO 0x40
+#define REGISTRO_PAGINAS 4
+#define REGISTRO_FLUSH_MS 1000
+#define REGISTRO_STACK_SIZE 3072
+
+// Informe periódico de CPU, pila, tiempo por iteración y ocupación de colas de
+// cada tarea (system_report). 0 = solo al entrar en TOTAL_FAILURE.
+#define INFORME_PERIODO_MS 10000
+
+// Trazas de latencia (traza.h). Con TRAZA_ENABLE cada mensaje lleva además los
+// instantes de publicación y de voto (8 bytes más). El monitor vuelca las
+// estadísticas cada TRAZA_PERIODO_MS (0 = solo bajo demanda).
+#define TRAZA_ENABLE 1
+#define TRAZA_PERIODO_MS 10000
+
 
 // Estrtuctura para mandar mensajes
+// Formato compacto en punto fijo: viajan los LSB del ADC y la media en centésimas
+// de grado; la conversión a float se hace solo en el monitor. Los campos están
+// ordenados por tamaño para que no haya relleno (20 bytes con un grupo de tres,
+// frente a los 32 del formato con floats).
 typedef struct{
 
-	uint8_t uid; //ID para identificar el emisor del mensaje
+	uint32_t ts_us;    // instante de la muestra (esp_timer_get_time, 32 bits bajos)
+#if TRAZA_ENABLE
+	uint32_t ts_envio_us; // instante en que el sensor publica el bloque
+	uint32_t ts_voto_us;  // instante del voto
+#endif
+	uint16_t seq;      // número de secuencia, lo asigna el sensor
 
-	float s1;
-	float s2;
-	float s3;
+	uint16_t lsb[THERM_NUM]; // lecturas de los termistores (ver THERM_CANALES)
 
-	uint16_t lsb1;
-	uint16_t lsb2;
-	uint16_t lsb3;
+	uint16_t media_raw[GRUPOS]; // voto de los LSB de cada grupo
+	int16_t media_cdeg[GRUPOS]; // media de las temperaturas de cada grupo, en centésimas de grado
 
-	float media;
-	uint16_t media_raw;
+	therm_mapa_t fallos; // canales que discrepan del voto (bit c = canal c, ver votador.h)
+	uint8_t uid; //ID para identificar el emisor del mensaje
 
 } mensaje;
 
@@ -85,15 +222,31 @@ typedef struct{
 // SENSOR
 // Tarea sensor
 SYSTEM_TASK(TASK_SENSOR);
+// modos de adquisición
+typedef enum
+{
+	SENSOR_ACQ_ONESHOT,    // temporizador + lectura oneshot de cada canal
+	SENSOR_ACQ_ENTRELAZADO, // temporizador + lecturas ABC-CBA alineadas (ver therm_read_aligned)
+	SENSOR_ACQ_CONTINUOUS  // ADC continuo, tramas por DMA (ver term_cont.c)
+}sensor_acq_t;
 // definición de los argumentos que requiere la tarea
 typedef struct 
 {
-	RingbufHandle_t* rbuf; // puntero al buffer 
-	uint8_t freq;          // frecuencia de muestreo
+	canal_t* rbuf; // puntero al buffer 
+	uint32_t periodo_ns;   // periodo de muestreo (modo oneshot)
+	sensor_acq_t acq;      // modo de adquisición
+	bool interpolar;       // interpola al instante común (modo entrelazado)
+	uint32_t cont_freq;    // conversiones/s entre todos los canales (modo continuo)
+	uint16_t batch;        // mensajes por bloque enviado (1..MSG_BATCH_MAX)
+	filtro_cfg_t filtro;   // filtrado y diezmado antes de publicar
     // ...
 }task_sensor_args_t;
 // Timeout de la tarea (ver system_task_stop)
 #define TASK_SENSOR_TIMEOUT_MS 2000 
+// Plazo común para detener todas las tareas a la vez (ver system_task_stop_all)
+#define TASK_STOP_ALL_TIMEOUT_MS 500
+// Plazo de la barrera de arranque: tareas listas en INIT (ver system_wait_ready)
+#define TASK_READY_TIMEOUT_MS 2000
 // Tamaño de la pila de la tarea
 #define TASK_SENSOR_STACK_SIZE 4096
 
@@ -103,7 +256,11 @@ SYSTEM_TASK(TASK_MONITOR);
 // definición de los argumentos que requiere la tarea
 typedef struct 
 {
-	RingbufHandle_t* rbuf; // puntero al buffer 
+	canal_t* rbuf; // puntero al buffer 
+	uint32_t ventana_ms;   // periodo del resumen estadístico (0 = sin resumen)
+	bool log_muestras;     // mostrar también las muestras individuales
+	uint32_t log_ms;       // intervalo mínimo entre muestras mostradas (0 = todas)
+	bool telemetria;       // enviar cada muestra en binario (telemetria.h)
     // ...
 }task_monitor_args_t;
 // Timeout de la tarea (ver system_task_stop)
@@ -113,12 +270,27 @@ typedef struct
 
 // VOTADOR
 SYSTEM_TASK(TASK_VOTADOR);
+typedef enum
+{
+	VOTADOR_MODO_BITS,      // mayoría 2 de 3 bit a bit de los LSB
+	VOTADOR_MODO_ANALOGICO  // mediana de tres con ventana de tolerancia
+}votador_modo_t;
+typedef enum
+{
+	VOTADOR_TOL_LSB,   // tolerancia en LSB del ADC
+	VOTADOR_TOL_CDEG   // tolerancia en centésimas de grado
+}votador_tol_t;
 // definición de los argumentos que requiere la tarea
 typedef struct 
 {
-	RingbufHandle_t* rbuf_read; // puntero al buffer que lee de los sensores
-	RingbufHandle_t* rbuf_write; // puntero al buffer que escribe al monitor
+	canal_t* rbuf_read; // puntero al buffer que lee de los sensores
+	canal_t* rbuf_write; // puntero al buffer que escribe al monitor
 	uint16_t mask;
+	uint16_t batch;              // máximo de mensajes por bloque reenviado (1..MSG_BATCH_MAX)
+	votador_modo_t modo;         // modo de voto
+	votador_tol_t tol_unidad;    // unidades de tol (modo analógico)
+	uint16_t tol;                // ventana de tolerancia entre cada par de sensores (modo analógico)
+	uint16_t histeresis;         // muestras seguidas con el mismo fallo antes de cambiar de estado
     // ...
 }task_votador_args_t;
 // Timeout de la tarea (ver system_task_stop)
@@ -0,0 +1,53 @@
+#ifndef __FILTRO_H__
+#define __FILTRO_H__
+
+// Etapa de filtrado entre la adquisición y el buffer hacia el votador.
+// Cada canal guarda sus últimas k muestras en un buffer circular de tamaño fijo
+// y, cada `decimacion` muestras de entrada, se emite una sola muestra filtrada
+// (sobremuestreo y diezmado N:1). Así el ADC puede muestrear deprisa mientras
+// votador y monitor reciben un flujo más lento y con menos ruido.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#define FILTRO_MAX_CANALES 16 // canales por muestra
+#define FILTRO_MAX_K 16       // longitud máxima de la ventana
+
+typedef enum
+{
+	FILTRO_NINGUNO,  // se emite la última muestra de cada grupo de `decimacion`
+	FILTRO_MEDIA,    // media móvil de las k últimas muestras
+	FILTRO_IIR,      // exponencial: y += (x - y) / 2^shift
+	FILTRO_MEDIANA   // mediana de las k últimas muestras
+}filtro_tipo_t;
+
+typedef struct
+{
+	filtro_tipo_t tipo;
+	uint8_t k;            // ventana de media y mediana (1..FILTRO_MAX_K)
+	uint8_t shift;        // constante del IIR (0..15)
+	uint16_t decimacion;  // muestras de entrada por cada muestra emitida (>= 1)
+}filtro_cfg_t;
+
+typedef struct
+{
+	filtro_cfg_t cfg;
+	size_t ncanales;
+	uint16_t ventana[FILTRO_MAX_CANALES][FILTRO_MAX_K]; // buffer circular por canal
+	uint32_t suma[FILTRO_MAX_CANALES];                   // suma de la ventana (media móvil)
+	uint32_t iir[FILTRO_MAX_CANALES];                    // estado del IIR, escalado por 2^shift
+	uint8_t pos;      // siguiente posición a escribir en la ventana
+	uint8_t llenos;   // muestras válidas en la ventana (hasta k)
+	uint16_t cuenta;  // muestras de entrada desde la última emitida
+}filtro_t;
+
+esp_err_t filtro_init(filtro_t *f, const filtro_cfg_t *cfg, size_t ncanales);
+
+// Añade una muestra de entrada (lsb[c] para cada canal). Devuelve true cuando
+// toca emitir, dejando en out la muestra filtrada de cada canal.
+bool filtro_muestra(filtro_t *f, const uint16_t *lsb, uint16_t *out);
+
+#endif
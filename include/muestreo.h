@@ -0,0 +1,58 @@
+#ifndef __MUESTREO_H__
+#define __MUESTREO_H__
+
+// Planificador del muestreo oneshot. En el ESP32 lo marca un gptimer de 100 ns
+// de resolución con recarga automática de la alarma en hardware: el periodo no
+// acumula deriva aunque la tarea se retrase, y la ISR solo anota el instante y
+// notifica a la tarea. En el target linux, sin gptimer, se usa un esp_timer
+// periódico con la misma interfaz.
+//
+// El tick k tiene como instante programado el del primer tick más k periodos.
+// Se mide el retraso respecto a ese instante en la ISR y al despertar la tarea,
+// y se cuentan los ticks perdidos (vencidos antes de atender el anterior).
+// Las estadísticas solo las toca la tarea que espera, así que no hay cerrojos.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+
+#include "traza.h"
+
+// Periodo mínimo admitido (ns). Por debajo el coste de ISR + cambio de contexto
+// se come el periodo completo. El esp_timer periódico no baja de 50 us.
+#if CONFIG_IDF_TARGET_LINUX
+#define MUESTREO_PERIODO_MIN_NS 50000u
+#else
+#define MUESTREO_PERIODO_MIN_NS 20000u
+#endif
+
+// Entrada del array de notificaciones de la tarea (la 1 la usan las colas SPSC)
+#define MUESTREO_NOTIFY_INDEX 0
+
+typedef struct
+{
+	uint32_t periodo_ns;
+	uint32_t ticks;       // ticks atendidos por la tarea
+	uint32_t perdidos;    // ticks vencidos sin que se atendiera el anterior
+	traza_hist_t isr;     // programado -> ISR (us)
+	traza_hist_t tarea;   // programado -> tarea despierta (us)
+}muestreo_stats_t;
+
+// Arranca el temporizador. Los ticks se notifican a la tarea que llama.
+esp_err_t muestreo_start(uint32_t periodo_ns);
+// Espera el siguiente tick. Devuelve false si vence el timeout o se ha pedido
+// despertar a la tarea (muestreo_despertar). En ts_us deja el instante programado del tick.
+bool muestreo_esperar(TickType_t timeout, uint32_t *ts_us);
+// Despierta a la tarea que espera y hace que las esperas siguientes devuelvan
+// false hasta el próximo muestreo_start (firma de system_task_wake_t, ver system.h)
+void muestreo_despertar(void *ctx);
+esp_err_t muestreo_stop(void);
+
+const muestreo_stats_t *muestreo_stats(void);
+void muestreo_reset_stats(void);
+// Vuelca ticks, perdidos y min/p50/p99/max del retraso en ISR y en la tarea
+void muestreo_volcar(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __REGISTRO_H__
+#define __REGISTRO_H__
+
+// Registro circular de muestras en flash. Las muestras votadas se acumulan en
+// páginas de RAM (REGISTRO_PAGINA_BYTES) y una tarea de escritura las vuelca a
+// la partición "registro" (partitions.csv) de una vez, de modo que el monitor
+// nunca espera a la flash. La partición se recorre por sectores de 4 KB: cada
+// sector se borra una sola vez al empezar a escribirlo, lleva una cabecera con
+// su número de secuencia y el número de arranque (contador guardado en NVS), y
+// al llegar al final se vuelve al primero, sobrescribiendo lo más antiguo.
+// El historial sobrevive a los reinicios, incluido el del watchdog del sensor;
+// como mucho se pierde lo que aún no se había volcado (REGISTRO_FLUSH_MS).
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#include "config.h"
+
+#define REGISTRO_SECTOR 4096
+#define REGISTRO_PAGINA_BYTES 256 // página de escritura de la flash
+#define REGISTRO_VALIDO 0xA5      // marca de registro escrito (la flash borrada lee 0xFF)
+#define REGISTRO_TODOS UINT32_MAX // cualquier arranque en registro_leer
+
+// Bytes útiles de una muestra y tamaño en flash: la siguiente potencia de dos
+// (a partir de 16), para que un número entero de muestras llene la página
+#define REGISTRO_DATOS (4 + 2 + 2 * THERM_NUM + 2 * GRUPOS + sizeof(therm_mapa_t) + 1)
+#define REGISTRO_TAM (REGISTRO_DATOS <= 16 ? 16 : REGISTRO_DATOS <= 32 ? 32 : REGISTRO_DATOS <= 64 ? 64 : 128)
+#define REGISTRO_HUECO (REGISTRO_TAM - REGISTRO_DATOS)
+
+// Muestra tal como se guarda en flash
+typedef struct __attribute__((packed))
+{
+	uint32_t ts_us;          // 32 bits bajos de esp_timer (ver registro_leer para el tiempo completo)
+	uint16_t seq;
+	uint16_t lsb[THERM_NUM];
+	int16_t media_cdeg[GRUPOS];
+	therm_mapa_t fallos;
+	uint8_t relleno[REGISTRO_HUECO];
+	uint8_t valido;          // REGISTRO_VALIDO
+}registro_muestra_t;
+
+#define REGISTRO_POR_PAGINA (REGISTRO_PAGINA_BYTES / sizeof(registro_muestra_t))
+
+// Callback de registro_leer: muestra, arranque en que se tomó y su instante
+// completo (us desde ese arranque). Devuelve false para terminar la lectura.
+typedef bool (*registro_cb_t)(const registro_muestra_t *m, uint32_t arranque, uint64_t t_us, void *ctx);
+
+// Abre la partición, incrementa el contador de arranques en NVS (ya
+// inicializada) y lanza la tarea de escritura en el núcleo indicado
+esp_err_t registro_init(BaseType_t core);
+bool registro_activo(void);
+uint32_t registro_arranque(void);
+
+// Añade una muestra a la página en curso. Solo la llama una tarea (el monitor).
+void registro_anotar(const mensaje *msg);
+// Entrega la página en curso aunque no esté llena. El monitor la llama
+// periódicamente, de modo que no haya más de REGISTRO_FLUSH_MS sin volcar.
+void registro_flush(void);
+
+// Recorre, de la más antigua a la más reciente, las muestras del arranque dado
+// (o REGISTRO_TODOS) con instante en [desde_us, hasta_us]. Devuelve cuántas ha entregado.
+size_t registro_leer(uint32_t arranque, uint64_t desde_us, uint64_t hasta_us, registro_cb_t cb, void *ctx);
+
+// Muestras perdidas porque la tarea de escritura no daba abasto, y escritas
+uint32_t registro_perdidas(void);
+uint32_t registro_escritas(void);
+
+#endif
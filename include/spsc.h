@@ -0,0 +1,78 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+// Cola circular de un productor y un consumidor (SPSC), sin cerrojos.
+// Pensada para enlazar dos tareas fijadas a núcleos distintos: cada índice
+// solo lo escribe un lado, así que basta con lecturas/escrituras atómicas y
+// no hace falta la sección crítica que usa el RingbufHandle_t de ESP-IDF en
+// cada operación. Los huecos son de tamaño fijo (máximo slot_size bytes) y el
+// almacenamiento lo reserva quien crea la cola, normalmente de forma estática.
+//
+// El uso imita al buffer cíclico en modo NOSPLIT: el productor pide un hueco
+// (spsc_acquire), escribe en él y lo publica (spsc_commit); el consumidor lo
+// recibe (spsc_receive), lo lee en el sitio y lo devuelve (spsc_release).
+// Las esperas por cola llena/vacía bloquean la tarea con una notificación.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Separación entre los índices de productor y consumidor para que no compartan línea
+#define SPSC_LINE 64
+#define SPSC_ALIGNED __attribute__((aligned(SPSC_LINE)))
+
+// Entrada del array de notificaciones que usa la cola (la 0 queda para la tarea)
+#if configTASK_NOTIFICATION_ARRAY_ENTRIES > 1
+#define SPSC_NOTIFY_INDEX 1
+#else
+#define SPSC_NOTIFY_INDEX 0
+#endif
+
+// Cada hueco lleva delante su longitud (uint32_t) y se alinea a 4 bytes
+#define SPSC_STRIDE(slot_size) ((sizeof(uint32_t) + (slot_size) + 3) & ~((size_t) 3))
+// Bytes de almacenamiento para nslots huecos de slot_size bytes
+#define SPSC_STORAGE_SIZE(nslots, slot_size) ((nslots) * SPSC_STRIDE(slot_size))
+
+typedef struct
+{
+	// lado productor
+	_Atomic uint32_t head SPSC_ALIGNED;  // huecos publicados (solo lo escribe el productor)
+	TaskHandle_t prod_task;
+	_Atomic uint32_t prod_wait;          // el productor duerme esperando hueco
+
+	// lado consumidor
+	_Atomic uint32_t tail SPSC_ALIGNED;  // huecos devueltos (solo lo escribe el consumidor)
+	TaskHandle_t cons_task;
+	_Atomic uint32_t cons_wait;          // el consumidor duerme esperando datos
+
+	// configuración, constante tras spsc_init
+	uint8_t *storage SPSC_ALIGNED;
+	uint32_t nslots;                     // potencia de 2
+	uint32_t slot_size;
+	uint32_t stride;
+	_Atomic uint32_t cerrada;            // spsc_cerrar: las esperas terminan sin dato
+}spsc_t;
+
+// nslots debe ser potencia de 2; storage debe tener SPSC_STORAGE_SIZE(nslots, slot_size) bytes
+void spsc_init(spsc_t *q, uint8_t *storage, uint32_t nslots, uint32_t slot_size);
+
+// productor
+void *spsc_acquire(spsc_t *q, size_t len, TickType_t timeout);
+void spsc_commit(spsc_t *q, void *ptr);
+
+// consumidor
+void *spsc_receive(spsc_t *q, size_t *len, TickType_t timeout);
+void spsc_release(spsc_t *q, void *ptr);
+
+// Despierta a quien espere en la cola y hace que las esperas siguientes
+// terminen de inmediato (NULL); lo que ya hay en la cola se sigue entregando.
+// Se puede llamar desde una tercera tarea (para detener productor o consumidor).
+void spsc_cerrar(spsc_t *q);
+
+// huecos ocupados (aproximado si se consulta desde una tercera tarea)
+uint32_t spsc_count(spsc_t *q);
+
+#endif
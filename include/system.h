@@ -8,10 +8,27 @@
 * PUBLIC FUNCTIONS :
 *       system_create
 *       system_register_state
+*       system_register_state_handlers
+*       system_register_transition
 *       system_set_default_state
+*       system_post_state
+*       system_hysteresis_init
+*       system_hysteresis_clear
+*       system_request_state
+*       system_wait_state
+*       system_print_stats
 *       system_task_start
 *       system_task_start_in_core
+*       system_task_start_static_in_core
 *		system_task_stop
+*		system_task_stop_all
+*		system_wait_ready
+*		system_release
+*		system_task_set_queue
+*		system_task_on_stop
+*		system_report
+*		system_reporter_start
+*		system_reporter_stop
 *		
 * MACROS:
 *		STATE_MACHINE(system)
@@ -21,8 +38,14 @@
 *       SYSTEM_TASK(task)
 *		TASK_BEGIN()/TASK_END()
 *		TASK_ARGS
+*		TASK_READY()
 *		TASK_LOOP()
+*		TASK_STOPPING()
+*		TASK_ON_STOP(wake, ctx)
+*		TASK_BUSY_BEGIN()
+*		SYSTEM_TASK_STACK(name, size)
 *		SWITCH_ST_FROM_TASK(state)
+*		SWITCH_ST_FROM_TASK_HYST(hyst, state)
 *
 * PUBLIC LICENSE :
 * Este código es de uso público y libre de modificar bajo los términos de la
@@ -35,64 +58,281 @@
 #ifndef __SYSTEM_H__
 #define __SYSTEM_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <freertos/event_groups.h>
 
-#include <esp_event.h>
+#include <esp_timer.h>
 
-// system
+#define SYSTEM_MAX_STATES 32       // states are numbered 0..SYSTEM_MAX_STATES-1
+#define SYSTEM_MAX_TRANSITIONS 32  // registered plus observed transitions
+#define SYSTEM_ANY_STATE 0xFE      // wildcard for system_register_transition
+#define SYSTEM_NO_STATE 0xFF       // state before the default state is entered
+#define SYSTEM_MAX_TASKS 23        // one event group bit per running task
+#define SYSTEM_READY_GO (1u << SYSTEM_MAX_TASKS) // sys_ready bit that releases the startup barrier
+#define SYSTEM_LOOP_BUCKETS 20     // loop busy time histogram: bucket i holds [2^i, 2^(i+1)) us
+#define SYSTEM_REPORTER_STACK_SIZE 3072
+
+// With static allocation available the kernel objects of a system (request queue, task
+// event group, reporter task) are stored in system_t or in system.c: no heap is used
+#if configSUPPORT_STATIC_ALLOCATION
+#define SYSTEM_STATIC 1
+#else
+#define SYSTEM_STATIC 0
+#endif
+
+// Stack for system_task_start_static_in_core, in StackType_t units (bytes in ESP-IDF)
+#define SYSTEM_TASK_STACK(name, size) static StackType_t name[size] __attribute__((aligned(16)))
+
+typedef struct system_t system_t;
+typedef struct system_task_t system_task_t;
+
+// Occupancy of a task input queue, for the reports: returns the bytes in use and the capacity
+typedef size_t (*system_queue_level_t)(void *ctx, size_t *capacity);
+
+// Wakes a task blocked on its own primitive (queue, notification...) so that it sees a stop request
+typedef void (*system_task_wake_t)(void *ctx);
+
+// Longest a task may block without a wake hook before it notices a stop request
+#define SYSTEM_STOP_POLL_MS 20
+
+// Entry/exit/transition handler. Runs in the state machine task.
+typedef void (*system_handler_t)(system_t *sys, uint8_t from, uint8_t to);
+// Guard: the transition is taken only if it returns true
+typedef bool (*system_guard_t)(system_t *sys, uint8_t from, uint8_t to);
+
+// state table entry
+typedef struct
+{
+	bool registered;
+	system_handler_t on_entry;
+	system_handler_t on_exit;
+}system_state_t;
+
+// transition table entry, with its latency counters (post -> entry handler done)
 typedef struct
+{
+	uint8_t from;                // state or SYSTEM_ANY_STATE
+	uint8_t to;                  // state or SYSTEM_ANY_STATE
+	system_guard_t guard;
+	system_handler_t action;
+	uint32_t count;              // times taken
+	uint32_t rejected;           // times refused by the guard
+	uint64_t latency_sum_us;
+	uint32_t latency_max_us;
+}system_transition_t;
+
+// system
+struct system_t
 {
 	char sys_id[16];                          // system id
-	SemaphoreHandle_t sys_st_mutex;          // mutex to change the system state
-	SemaphoreHandle_t sys_new_state;         // lock to wait a new state
-	uint8_t sys_state;                       // system current state
-	uint8_t sys_nstates;                     // number of states
-	esp_event_loop_handle_t sys_evt_loop;    // system event loop handler
-	esp_event_loop_args_t sys_evt_loop_args; // system event loop configuration
-}system_t;
+	volatile uint8_t sys_state;               // system current state
+	uint8_t sys_nstates;                      // number of states
+	QueueHandle_t sys_queue;                  // pending state requests (one slot per state)
+	_Atomic uint32_t sys_pending;             // bit st: st is already queued
+	int64_t sys_pending_us[SYSTEM_MAX_STATES];// time of the first request still queued
+	system_state_t sys_states[SYSTEM_MAX_STATES];
+	system_transition_t sys_transitions[SYSTEM_MAX_TRANSITIONS];
+	uint8_t sys_ntransitions;
+	uint32_t sys_untracked;                   // transitions taken with the table full (no counters)
+	// counters
+	_Atomic uint32_t sys_posted;              // requests queued
+	_Atomic uint32_t sys_coalesced;           // requests merged with a queued one or with the current state
+	_Atomic uint32_t sys_dropped;             // requests lost because the queue was full
+	_Atomic uint32_t sys_suppressed;          // requests filtered out by a system_hysteresis_t
+	// tasks
+	EventGroupHandle_t sys_tasks;             // bit of a task set when it has finished
+	EventBits_t sys_task_bits;                // bits in use
+	system_task_t *sys_task_list[SYSTEM_MAX_TASKS]; // running task by bit index
+	EventGroupHandle_t sys_ready;             // startup barrier: bit of a task set when it is ready
+#if SYSTEM_STATIC
+	// storage of sys_queue, sys_tasks and sys_ready
+	StaticQueue_t sys_queue_buf;
+	uint8_t sys_queue_storage[SYSTEM_MAX_STATES];
+	StaticEventGroup_t sys_tasks_buf;
+	StaticEventGroup_t sys_ready_buf;
+#endif
+};
 
-// system tasks
+// per-requester filter for state requests coming from hot paths
 typedef struct
+{
+	uint8_t last_st;        // state of the current streak (SYSTEM_NO_STATE: none)
+	bool posted;            // the current streak has already been posted
+	uint16_t streak;        // consecutive requests for last_st
+	uint16_t threshold;     // consecutive requests needed to post
+	uint32_t suppressed;    // requests not posted by this filter
+}system_hysteresis_t;
+
+// system tasks
+typedef enum
+{
+	SYSTEM_TASK_RUNNING,
+	SYSTEM_TASK_STOPPING,   // stop requested, TASK_LOOP() ends
+	SYSTEM_TASK_WAKING,     // stopping, and the stopper is running the wake hook: TASK_END() waits
+	SYSTEM_TASK_EXITED,     // reached TASK_END() and deleted itself
+	SYSTEM_TASK_KILLED      // deleted by the stopper after the deadline
+}system_task_state_t;
+
+struct system_task_t
 {
 	system_t *system;
-	SemaphoreHandle_t sys_task_stop;
+	_Atomic int sys_task_state;          // system_task_state_t
+	EventBits_t sys_task_bit;            // bit in system->sys_tasks
 	TaskHandle_t sys_task_handler;
 	void *sys_task_args;
-}system_task_t;
+	const char *sys_task_name;
+	// timing
+	int64_t sys_task_created_us;         // when the task was created
+	int64_t sys_task_end_us;             // when the task reached TASK_END()
+	uint32_t sys_task_start_us;          // creation -> TASK_BEGIN()
+	uint32_t sys_task_ready_us;          // creation -> TASK_READY()
+	uint32_t sys_task_stop_us;           // stop request -> TASK_END() (last stop)
+	// instrumentation (written by the task, read by the reports without locking)
+	configSTACK_DEPTH_TYPE sys_task_stack; // stack size given at creation
+	int64_t sys_task_busy_start;         // TASK_BUSY_BEGIN() of the current iteration (0: none)
+	uint32_t sys_task_loops;             // iterations with a busy mark
+	uint32_t sys_task_busy_max_us;
+	uint64_t sys_task_busy_sum_us;
+	uint32_t sys_task_busy_hist[SYSTEM_LOOP_BUCKETS];
+	system_task_wake_t sys_task_wake;    // wakes the task on a stop request (optional)
+	void *sys_task_wake_ctx;
+	system_queue_level_t sys_task_queue; // input queue occupancy (optional)
+	void *sys_task_queue_ctx;
+	size_t sys_task_queue_max;           // highest occupancy seen by the reports
+	uint32_t sys_task_prev_runtime;      // run time counter at the previous report
+	int64_t sys_task_prev_report_us;
+#if SYSTEM_STATIC
+	StaticTask_t sys_task_tcb;           // TCB for system_task_start_static_in_core
+#endif
+};
 
 /**
- * The function `system_create` creates a system object with a given ID and initializes its mutexes and
- * event loop.
+ * The function `system_create` creates a system object with a given ID and initializes its state and
+ * transition tables and the queue of state requests.
  * 
  * @param sys A pointer to a structure of type system_t, which represents the system being created.
  * @param id The id parameter is a string that represents the unique identifier for the system. It is
- * used to name the system event loop task and is also copied into the sys_id field of the system_t
- * structure.
+ * copied into the sys_id field of the system_t structure (at most 15 characters).
  */
 void system_create(system_t* sys, const char* id);
 
 // system add state
 /**
- * The function `system_register_state` registers a system state with an event loop and increments the
- * number of states in the system.
+ * The function `system_register_state` registers a state in the system state table, without
+ * entry or exit handlers, and increments the number of states in the system.
  * 
  * @param sys A pointer to the system structure that contains information about the system.
- * @param st The parameter "st" is of type uint8_t, which means it is an unsigned 8-bit integer. It is
- * used to represent the state that is being registered in the system.
+ * @param st The state being registered (0..SYSTEM_MAX_STATES-1).
  */
 void system_register_state(system_t *sys, uint8_t st);
 
+/**
+ * The function `system_register_state_handlers` registers a state together with the handlers run
+ * when the machine enters and leaves it. Either handler may be NULL.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param st The state being registered.
+ * @param on_entry Handler run after the machine has switched to `st`.
+ * @param on_exit Handler run before the machine leaves `st`.
+ */
+void system_register_state_handlers(system_t *sys, uint8_t st, system_handler_t on_entry, system_handler_t on_exit);
+
+/**
+ * The function `system_register_transition` adds an entry to the transition table. When a request
+ * for `to` arrives in state `from`, the first matching entry (in registration order, either field
+ * may be SYSTEM_ANY_STATE) decides: if its guard returns false the request is rejected, otherwise
+ * the exit handler of `from`, the transition action and the entry handler of `to` are run in that
+ * order. Transitions without an entry are always allowed. A request for the current state is
+ * ignored (counted as coalesced) unless an entry matches it.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param from Source state or SYSTEM_ANY_STATE.
+ * @param to Destination state or SYSTEM_ANY_STATE.
+ * @param guard Guard function, or NULL to always allow.
+ * @param action Transition handler, or NULL.
+ */
+void system_register_transition(system_t *sys, uint8_t from, uint8_t to, system_guard_t guard, system_handler_t action);
+
 // system set default state
 /**
- * The function sets the default state of a system and gives a semaphore if it is not already taken.
+ * The function sets the default state of a system: it is the first state returned by
+ * system_wait_state, and its entry handler is run then.
  * 
  * @param sys A pointer to a structure of type system_t, which represents the system.
  * @param default_st The default state to set for the system.
  */
 void system_set_default_state(system_t *sys, uint8_t default_st);
 
+/**
+ * The function `system_post_state` requests a state change. A request for a state that is
+ * already queued is merged with it, so the queue can never hold more than one request per state.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param st The requested state.
+ * @param timeout Ticks to wait if the queue is full.
+ * 
+ * @return pdTRUE if the request is queued or merged, pdFALSE if it was dropped.
+ */
+BaseType_t system_post_state(system_t *sys, uint8_t st, TickType_t timeout);
+
+/**
+ * The function `system_hysteresis_init` initializes a request filter. The filter belongs to a
+ * single task and needs no locking.
+ * 
+ * @param h A pointer to the filter.
+ * @param threshold Consecutive requests for the same state needed before it is posted (0 or 1:
+ * post on the first one).
+ */
+void system_hysteresis_init(system_hysteresis_t *h, uint16_t threshold);
+
+/**
+ * The function `system_hysteresis_clear` ends the current streak, e.g. when the condition that
+ * triggered the requests is no longer observed.
+ * 
+ * @param h A pointer to the filter.
+ */
+void system_hysteresis_clear(system_hysteresis_t *h);
+
+/**
+ * The function `system_request_state` is the non-blocking request for hot paths. The request is
+ * posted only once per streak, when `threshold` consecutive requests for the same state have been
+ * seen and the machine is not already in that state; every other call is counted as suppressed.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param h A pointer to the requester's filter.
+ * @param st The requested state.
+ * 
+ * @return pdTRUE if the request was handed to the state machine, pdFALSE if it was suppressed or
+ * dropped.
+ */
+BaseType_t system_request_state(system_t *sys, system_hysteresis_t *h, uint8_t st);
+
+/**
+ * The function `system_wait_state` blocks the state machine task until a request is accepted and
+ * applies it (guard, exit, action and entry handlers), updating the latency counters. Rejected or
+ * coalesced requests do not wake the caller.
+ * 
+ * @param sys A pointer to the system structure.
+ * 
+ * @return The new current state.
+ */
+uint8_t system_wait_state(system_t *sys);
+
+/**
+ * The function `system_print_stats` logs the request counters and the latency of every
+ * transition taken so far.
+ * 
+ * @param sys A pointer to the system structure.
+ */
+void system_print_stats(system_t *sys);
+
 // system task start
 /**
  * The function __system_task_start initializes a system task by assigning the system, creating a mutex
@@ -133,21 +373,146 @@ void system_task_start(system_t *sys, system_task_t *task, TaskFunction_t functi
 void system_task_start_in_core(system_t *sys, system_task_t *task, TaskFunction_t function, const char * const name,
 					configSTACK_DEPTH_TYPE stack_depth, void* args, UBaseType_t priority, BaseType_t coreid);
 
+#if SYSTEM_STATIC
+/**
+ * The function `system_task_start_static_in_core` is `system_task_start_in_core` with
+ * caller provided memory: the TCB is stored in the system_task_t and the stack is `stack`
+ * (see SYSTEM_TASK_STACK). Creating or deleting the task never touches the heap. The
+ * buffers must not be reused for a new task until the previous one has been deleted.
+ * 
+ * @param stack Stack buffer of at least `stack_depth` StackType_t elements.
+ * @param stack_depth Size of `stack`, in StackType_t units (bytes in ESP-IDF).
+ */
+void system_task_start_static_in_core(system_t *sys, system_task_t *task, TaskFunction_t function, const char * const name,
+					StackType_t *stack, configSTACK_DEPTH_TYPE stack_depth, void* args, UBaseType_t priority, BaseType_t coreid);
+#endif
+
 // system task stop 
 /**
- * The function stops a system task and deletes its handler and associated resources.
+ * The function stops a system task: it is a call to system_task_stop_all with a single task.
  * 
  * @param sys A pointer to the system structure that contains the task.
  * @param task A pointer to the system_task_t structure representing the task to be stopped.
  * @param timeout_ms The timeout_ms parameter is the maximum amount of time, in milliseconds, that the
- * function will wait for the task to stop before timing out.
+ * function will wait for the task to stop before deleting it.
  */
 void system_task_stop(system_t *sys, system_task_t *task, uint16_t timeout_ms);
 
+/**
+ * The function `system_task_stop_all` stops several tasks in parallel. It flags all of them, wakes
+ * the ones that are blocked through their wake hook (see `system_task_on_stop`) so that they see
+ * the flag at once, and waits on the system event group until every task has reached TASK_END()
+ * or the common deadline expires. Tasks without a hook must not block for longer than
+ * SYSTEM_STOP_POLL_MS between checks of the flag, or they use up the deadline.
+ * Tasks still running at the deadline are deleted. Tasks that are not running are skipped.
+ * 
+ * @param sys A pointer to the system structure that contains the tasks.
+ * @param tasks Array of pointers to the tasks to stop.
+ * @param n Number of tasks in the array.
+ * @param timeout_ms Deadline for all the tasks, in milliseconds.
+ * 
+ * @return The number of tasks that had to be deleted at the deadline.
+ */
+int system_task_stop_all(system_t *sys, system_task_t *const tasks[], size_t n, uint32_t timeout_ms);
+
+/**
+ * The function `system_task_set_queue` gives the reports a way to read the occupancy of the queue
+ * the task consumes from.
+ * 
+ * @param task A pointer to the task.
+ * @param level Function returning the bytes in use and the capacity of the queue.
+ * @param ctx Argument passed to `level`.
+ */
+void system_task_set_queue(system_task_t *task, system_queue_level_t level, void *ctx);
+
+/**
+ * The function `system_task_on_stop` registers how to wake the task when a stop is requested. The
+ * hook must act on the primitive the task blocks on (post to its queue, give its notification) so
+ * that the wait returns normally; tasks are never woken with xTaskAbortDelay, which would also
+ * break their waits on mutexes (logging, stdout, UART). While the hook runs TASK_END() waits, so
+ * the hook may use the task handle. It may be called more than once.
+ * 
+ * @param task A pointer to the task.
+ * @param wake Function that wakes the task.
+ * @param ctx Argument passed to `wake`.
+ */
+void system_task_on_stop(system_task_t *task, system_task_wake_t wake, void *ctx);
+
+/**
+ * The function `system_report` logs, for every running task of the system, the CPU time used
+ * since the previous report (needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS), the minimum free
+ * stack, the busy time per loop iteration (mean, max and percentiles from the histogram) and the
+ * occupancy of its input queue, plus the load of each core.
+ * 
+ * @param sys A pointer to the system structure.
+ */
+void system_report(system_t *sys);
+
+/**
+ * The function `system_reporter_start` creates a low priority task that calls system_report every
+ * `period_ms` milliseconds.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param period_ms Report period in milliseconds.
+ * @param coreid Core the reporter is pinned to.
+ */
+void system_reporter_start(system_t *sys, uint32_t period_ms, BaseType_t coreid);
+
+/**
+ * The function `system_reporter_stop` stops the reporter task. It waits for a report in progress,
+ * so once it returns the reporter no longer reads the task list: call it before stopping the
+ * tasks, whose handles become invalid when they exit. Does nothing if the reporter was not
+ * started.
+ */
+void system_reporter_stop(void);
+
+/**
+ * The function `system_wait_ready` is the main side of the startup barrier. It waits until every
+ * task in `tasks` has called TASK_READY() or `timeout_ms` expires, and logs how long each task
+ * took to get ready. The tasks stay blocked in TASK_READY() until system_release is called.
+ * 
+ * @param sys A pointer to the system structure.
+ * @param tasks Tasks that take part in the barrier.
+ * @param n Number of tasks.
+ * @param timeout_ms Maximum time to wait.
+ * 
+ * @return true if all the tasks are ready.
+ */
+bool system_wait_ready(system_t *sys, system_task_t *const tasks[], size_t n, uint32_t timeout_ms);
+
+/**
+ * The function `system_release` opens the startup barrier: every task blocked in TASK_READY(),
+ * and any task that reaches it later, goes on into its loop.
+ * 
+ * @param sys A pointer to the system structure.
+ */
+void system_release(system_t *sys);
+
+// task side of the lifecycle (used by the TASK_* macros)
+void system_task_begin(system_task_t *task);
+void system_task_ready(system_task_t *task);
+void system_task_end(system_task_t *task);
+void system_task_busy_end(system_task_t *task);
+
+static inline bool system_task_stopping(system_task_t *task)
+{
+	return atomic_load_explicit(&task->sys_task_state, memory_order_acquire) != SYSTEM_TASK_RUNNING;
+}
+
+// end of a loop iteration: accounts the busy time, if marked, and checks the stop flag
+static inline bool system_task_loop(system_task_t *task)
+{
+	if (task->sys_task_busy_start != 0)
+	{
+		system_task_busy_end(task);
+	}
+	return !system_task_stopping(task);
+}
+
 #define system_task_alive(sys, task) ((task)->system == (sys))
 
 // macros to develop the state machine system
-#define STATE_MACHINE(sys) while(1){if(xSemaphoreTake(sys.sys_new_state, pdMS_TO_TICKS(100)) == pdTRUE){switch (sys.sys_state)
+#define STATE_MACHINE(sys) while(1){if(system_wait_state(&(sys)) != SYSTEM_NO_STATE){switch (sys.sys_state)
 
 #define STATE_MACHINE_BEGIN()
 
@@ -162,19 +527,34 @@ void system_task_stop(system_t *sys, system_task_t *task, uint16_t timeout_ms);
 // macros to develop tasks
 #define SYSTEM_TASK(fn) void fn(void *__ptr)
 
-#define TASK_BEGIN() system_task_t *__task = (system_task_t*) __ptr
+#define TASK_BEGIN() system_task_t *__task = (system_task_t*) __ptr; system_task_begin(__task)
 		
 		
-#define TASK_END() xSemaphoreGive(__task->sys_task_stop);vTaskDelay(pdMS_TO_TICKS(50)); while(1) vTaskDelay(pdMS_TO_TICKS(50))
-//vTaskDelete(NULL)
+#define TASK_END() system_task_end(__task)
 	
 #define TASK_ARGS __task->sys_task_args
 
-#define TASK_LOOP() while(uxSemaphoreGetCount(__task->sys_task_stop))
+// startup barrier: signals that the task is initialised and blocks until system_release
+// (or until a stop request, checked every SYSTEM_STOP_POLL_MS)
+#define TASK_READY() system_task_ready(__task)
+
+#define TASK_LOOP() while(system_task_loop(__task))
+
+// marks the start of the work in a loop iteration (after the blocking wait); the busy time
+// until the end of the iteration goes to the task histogram
+#define TASK_BUSY_BEGIN() (__task->sys_task_busy_start = esp_timer_get_time())
+
+// true once a stop has been requested: a blocking call that returns early may be the stop waking the task
+#define TASK_STOPPING() system_task_stopping(__task)
+
+// wake hook for stop requests (see system_task_on_stop)
+#define TASK_ON_STOP(wake, ctx) system_task_on_stop(__task, wake, ctx)
 
 // macros to switch state from a task
-#define SWITCH_ST_FROM_TASK(new_st)     esp_event_post_to(__task->system->sys_evt_loop, (esp_event_base_t) __task->system->sys_id, new_st, NULL, 0, portMAX_DELAY)
-#define SWITCH_ST(sys, new_st) esp_event_post_to((sys)->sys_evt_loop, (esp_event_base_t) (sys)->sys_id, new_st, NULL, 0, portMAX_DELAY)
+// (non-blocking: tasks never wait on the state machine)
+#define SWITCH_ST_FROM_TASK(new_st)     system_post_state(__task->system, new_st, 0)
+#define SWITCH_ST_FROM_TASK_HYST(hyst, new_st) system_request_state(__task->system, hyst, new_st)
+#define SWITCH_ST(sys, new_st) system_post_state(sys, new_st, portMAX_DELAY)
 
 #define GET_ST_FROM_TASK() __task->system->sys_state
 
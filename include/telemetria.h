@@ -0,0 +1,54 @@
+#ifndef __TELEMETRIA_H__
+#define __TELEMETRIA_H__
+
+// Telemetría binaria. Cada mensaje votado se codifica en un registro compacto
+// (número de secuencia y diferencias en varint zigzag respecto al registro
+// anterior), se le añade un CRC-16 y se enmarca con COBS entre dos 0x00.
+// Un registro típico ocupa 12-16 bytes frente a los 60-80 de cada línea de log.
+// Cada TELEMETRIA_CLAVE registros se envía uno con los valores absolutos, para
+// que el receptor se resincronice tras perder o corromper una trama.
+// En el ESP32 se escribe en la UART de la consola; en el target linux, en un
+// fichero. El decodificador de host es tools/telemetria_decode.py. En la UART
+// las tramas se mezclan con el texto del log: el 0x00 inicial lo separa de la
+// trama siguiente, y como cada delta dice sobre qué registro se calculó, el
+// receptor descarta el texto sin perder la referencia de las diferencias.
+//
+// Formato del registro (antes de COBS):
+//   tipo (1 byte: TELEMETRIA_REG_CLAVE | TELEMETRIA_REG_DELTA)
+//   [solo en clave: número de canales n y de grupos g (1 byte cada uno)]
+//   [solo en delta: 8 bits bajos del seq del registro anterior]
+//   seq (uint16, little endian)
+//   ts_us, lsb[0..n-1], y media_raw, media_cdeg de cada grupo: varint zigzag
+//   (absolutos en clave, diferencia con el registro anterior en delta)
+//   fallos (varint: mapa de bits de los n canales)
+//   CRC-16/CCITT-FALSE de todo lo anterior (uint16, little endian)
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#include "config.h"
+
+#define TELEMETRIA_REG_CLAVE 0x01
+#define TELEMETRIA_REG_DELTA 0x02
+
+// Registro más largo: cabecera, seq, (1 + THERM_NUM + 2 * GRUPOS) varint de 5 bytes, fallos y CRC
+#define TELEMETRIA_MAX_REG (3 + 2 + (1 + THERM_NUM + 2 * GRUPOS) * 5 + 5 + 2)
+// COBS añade un byte cada 254, y los dos delimitadores
+#define TELEMETRIA_MAX_TRAMA (TELEMETRIA_MAX_REG + TELEMETRIA_MAX_REG / 254 + 3)
+
+esp_err_t telemetria_init(void);
+// Codifica un mensaje y lo añade al buffer de salida (se envía al llenarse)
+void telemetria_enviar(const mensaje *msg);
+// Envía lo pendiente
+void telemetria_flush(void);
+// Tramas y bytes enviados desde telemetria_init
+uint32_t telemetria_tramas(void);
+uint32_t telemetria_bytes(void);
+
+// Codifica un registro en una trama COBS sin enviarla y actualiza el estado de las diferencias.
+// Devuelve los bytes escritos en trama (como mucho TELEMETRIA_MAX_TRAMA).
+size_t telemetria_codificar(const mensaje *msg, uint8_t *trama);
+
+#endif
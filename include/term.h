@@ -1,17 +1,30 @@
 #ifndef __THERM_H__
 #define __THERM_H__
+#include <sdkconfig.h>
+#if CONFIG_IDF_TARGET_LINUX
+// En el target linux no existe el driver de ADC ni de GPIO. Se definen los tipos
+// mínimos para que el resto del proyecto compile igual en host (ver term_sim.c)
+typedef enum { ADC_UNIT_1, ADC_UNIT_2 } adc_unit_t;
+typedef enum {
+    ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_4,
+    ADC_CHANNEL_5, ADC_CHANNEL_6, ADC_CHANNEL_7, ADC_CHANNEL_8, ADC_CHANNEL_9,
+} adc_channel_t;
+#else
 #include <esp_adc/adc_oneshot.h>
 #include <hal/adc_types.h>
+#include <driver/gpio.h>
+#endif
 // libc
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <sys/time.h>
 
 // freerqtos
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
-#include <driver/gpio.h>
 
 // esp
 #include <esp_system.h>
@@ -26,24 +39,113 @@
 #define BETA_COEFFICIENT 3950 // Constante B
 #define GPIO_OUTPUT_PIN_2 2 //Puerto GPIO de salida
 
+#define THERM_LSB_MAX 4095 // Fondo de escala del ADC (12 bits)
+#define THERM_LUT_SIZE (THERM_LSB_MAX + 1) // Una entrada por cada valor del ADC
+#define THERM_LUT_FX_SHIFT 4 // Tabla de punto fijo: una entrada cada 16 LSB, interpolando entre ellas
+
+#define THERM_SIM_MAX_CHANNELS 10 // Canales por unidad que puede simular el backend de host
+#define THERM_ADC_UNITS 2 // ADC_UNIT_1 y ADC_UNIT_2
+#define THERM_ADC_ATTEN ADC_ATTEN_DB_11 // Atenuación de todos los canales (también para su calibración)
+#define THERM_CONT_MAX_CHANNELS 8 // Canales en la tabla de patrones del modo continuo
+#define THERM_CONT_FRAME_SAMPLES 64 // Muestras por canal en cada trama DMA
+#define THERM_ALINEADO_MAX 16 // Canales por lectura entrelazada (therm_read_aligned)
+
+
+// Entrada ADC de un termistor: unidad y canal. El ESP32 tiene dos unidades
+// independientes, de modo que los sensores redundantes de un grupo pueden
+// repartirse entre ambas y un fallo de una unidad no deja al grupo sin mayoría.
+typedef struct therm_chan_t{
+ adc_unit_t unit;
+ adc_channel_t channel;
+}therm_chan_t;
 
 typedef struct therm_conf_t{
+ adc_unit_t adc_unit;
  adc_channel_t adc_channel;
  int gpio_pin;
 }therm_t;
 
+// Muestra de un termistor: el valor bruto y la temperatura salen de la misma conversión
+typedef struct therm_sample_t{
+ uint16_t lsb;
+ float t;
+}therm_sample_t;
+
+// Backend de adquisición. Todas las lecturas pasan por él, de forma que el ADC
+// del ESP32 se puede sustituir por una fuente simulada sin tocar las tareas.
+typedef struct therm_backend_t{
+ const char* name;
+ esp_err_t (*init)(void);
+ esp_err_t (*config)(adc_unit_t unit, adc_channel_t channel);
+ esp_err_t (*read)(adc_unit_t unit, adc_channel_t channel, int* raw);
+}therm_backend_t;
+
+extern const therm_backend_t therm_backend_adc; // ADC oneshot del ESP32 (no disponible en linux)
+extern const therm_backend_t therm_backend_sim; // Reproducción de trazas LSB (term_sim.c)
 
 // funciones inicializacion y configuracion
+esp_err_t therm_set_backend(const therm_backend_t* backend); // llamar antes de therm_init
+const therm_backend_t* therm_get_backend(void);
 esp_err_t therm_init();
-esp_err_t therm_config(therm_t* thermistor,adc_channel_t channel, int gpio_pin);
+esp_err_t therm_config(therm_t* thermistor, therm_chan_t chan, int gpio_pin);
 //funcionalidades thermistor
 float therm_read_t(therm_t thermistor);
 float therm_read_v (therm_t thermistor);
 uint16_t therm_read_lsb(therm_t thermistor);
+// Una única conversión por termistor, de la que se derivan LSB y temperatura
+therm_sample_t therm_read(therm_t thermistor);
+// Lectura de n termistores (una conversión cada uno). t puede ser NULL si solo interesa el LSB
+esp_err_t therm_read_all(const therm_t* thermistors, size_t n, uint16_t* lsb, float* t);
+
+// Instantes de una lectura entrelazada, en us
+typedef struct therm_alineado_t{
+ uint32_t t_us;      // instante común al que corresponden todos los canales
+ uint32_t sesgo_us;  // primer canal -> último en una pasada: el sesgo de una lectura secuencial
+ uint32_t espejo_us; // dispersión de los centroides por canal tras el orden espejo
+}therm_alineado_t;
+// Lectura entrelazada: dos conversiones por canal en orden espejo (ABC-CBA),
+// cada una con su marca de tiempo (punto medio de la conversión). Con
+// conversiones equiespaciadas el centroide de todos los canales coincide y la
+// media de sus dos lecturas está alineada; lo que no lo está (una interrupción
+// entre medias) es espejo_us. Con interpolar, cada canal se interpola
+// linealmente entre sus dos lecturas al instante común, lo que elimina también
+// ese resto. n <= THERM_ALINEADO_MAX.
+esp_err_t therm_read_aligned(const therm_t* thermistors, size_t n, bool interpolar, uint16_t* lsb, therm_alineado_t* al);
 void therm_up(therm_t thermistor);
 void therm_down(therm_t thermistor);
 
 // Converion lsb a temperatura
+// Tras therm_lut_init usan tablas precalculadas (sin log ni divisiones por muestra).
+// Antes de construirlas, o con convert_lsb_t_formula, se aplica la ecuación Beta.
+// La tabla de float solo existe con BENCH_ENABLE; sin ella convert_lsb_t sale de
+// la de punto fijo (resolución de una centésima de grado).
+esp_err_t therm_lut_init(void);
 float convert_lsb_t(uint16_t lsb_value);
+float convert_lsb_t_formula(uint16_t lsb_value);
+// Variante en punto fijo: centésimas de grado, interpolando linealmente en una
+// tabla reducida de (THERM_LSB_MAX >> THERM_LUT_FX_SHIFT) + 2 = 257 entradas
+int16_t convert_lsb_cdeg(uint16_t lsb_value);
+// Memoria estática de las tablas de conversión nominales
+size_t therm_lut_bytes(void);
+
+// Adquisición continua (DMA). El ADC recorre en bucle la tabla de patrones con
+// los canales indicados a sample_freq_hz conversiones/s (entre todos los canales)
+// y la tarea recibe las muestras por tramas, sin ninguna lectura oneshot.
+// Sustituye a therm_init/therm_config: no se pueden usar ambos modos a la vez.
+// Con el ADC real solo admite canales de ADC_UNIT_1 (el DMA del ESP32 no lee ADC2).
+esp_err_t therm_cont_start(const therm_chan_t* channels, size_t nchannels, uint32_t sample_freq_hz);
+// Bloquea hasta tener una trama y la devuelve desentrelazada: lsb[i*nchannels + c]
+// es la muestra i del canal c. Devuelve el número de muestras por canal (0 si timeout).
+size_t therm_cont_read(uint16_t* lsb, size_t max_samples, uint32_t timeout_ms);
+esp_err_t therm_cont_stop(void);
+uint32_t therm_cont_overflows(void); // tramas perdidas por no leer a tiempo
+uint32_t therm_cont_freq(void); // conversiones/s efectivas (tras ajustar a los límites del ADC)
+
+// Backend simulado. Sin traza cargada, cada canal genera una señal sintética
+// (base + senoide + ruido). Con traza, se reproduce en bucle muestra a muestra.
+esp_err_t therm_sim_set_synthetic(uint16_t base, uint16_t amplitude, uint16_t noise, uint32_t period);
+esp_err_t therm_sim_load_trace(therm_chan_t chan, const uint16_t* trace, size_t len);
+// Carga un CSV con una columna de LSB por canal (en el orden de channels[])
+esp_err_t therm_sim_load_csv(const char* path, const therm_chan_t* channels, size_t nchannels);
 
-#endif
\ No newline at end of file
+#endif
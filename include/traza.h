@@ -0,0 +1,58 @@
+#ifndef __TRAZA_H__
+#define __TRAZA_H__
+
+// Trazas de latencia del pipeline. Cada mensaje lleva el instante de muestreo
+// (tick del temporizador), el de publicación en el sensor y el del voto; el
+// monitor añade el de llegada y acumula un histograma por etapa. También
+// cuenta mensajes perdidos o desordenados a partir del número de secuencia.
+// Cada histograma tiene una sola tarea que lo actualiza y lo vuelca, así que no
+// necesita cerrojos: los de las etapas del pipeline, el monitor; los de la
+// activación del muestreo (muestreo.c, desde muestreo_esperar) y los de la
+// alineación de canales (sesgo y espejo), la tarea sensor.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+typedef enum
+{
+	TRAZA_ADQUISICION,      // tick del temporizador -> publicado por el sensor
+	TRAZA_SENSOR_VOTADOR,   // publicado -> votado
+	TRAZA_VOTADOR_MONITOR,  // votado -> recibido por el monitor
+	TRAZA_TOTAL,            // tick -> monitor
+	TRAZA_NUM_ETAPAS
+}traza_etapa_t;
+
+// Histograma log-lineal: 4 cubetas por potencia de 2 (resolución del 25 %)
+#define TRAZA_CUBETAS 124
+
+typedef struct
+{
+	uint32_t n;
+	uint32_t min;
+	uint32_t max;
+	uint64_t suma;
+	uint32_t cubetas[TRAZA_CUBETAS];
+}traza_hist_t;
+
+void traza_reset(void);
+
+// Registra un mensaje votado que acaba de llegar al monitor
+void traza_registrar(const mensaje *msg, uint32_t ahora_us);
+
+// Vuelca min/p50/p99/max por etapa y los contadores por log
+void traza_volcar(void);
+
+// Volcado bajo demanda: cualquier tarea lo pide y el monitor lo atiende
+void traza_solicitar_volcado(void);
+bool traza_volcado_pendiente(void);
+
+// Histograma log-lineal reutilizable fuera de las etapas (p. ej. muestreo.c)
+void traza_hist_add(traza_hist_t *h, uint32_t v);
+uint32_t traza_percentil(const traza_hist_t *h, float p);
+const traza_hist_t *traza_etapa(traza_etapa_t etapa);
+uint32_t traza_perdidos(void);
+uint32_t traza_desordenados(void);
+
+#endif
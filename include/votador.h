@@ -0,0 +1,75 @@
+#ifndef __VOTADOR_H__
+#define __VOTADOR_H__
+
+// Núcleo de votación N-modular bit a bit sobre bloques de mensajes. Cada
+// llamada vota un grupo (SENSORES_GRUPO canales consecutivos de lsb[]).
+// Con tres sensores empaqueta dos muestras en cada palabra de 32 bits, de modo
+// que cada operación lógica vota dos muestras a la vez; con N sensores cuenta,
+// bit a bit, cuántos lo tienen a 1. Además de la mayoría identifica qué canal
+// discrepa: el canal c está en fallo cuando (lsb[c] ^ mayoría) & mask != 0.
+// Así, si los sensores 1 y 2 difieren pero el 2 coincide con el 3, el culpable
+// es el 1 y no al revés.
+// También ofrece un voto analógico (mediana y ventana de tolerancia) para
+// cuando el ruido de los LSB bajos hace inservible la comparación bit a bit.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+// Bits del campo fallos de mensaje
+#define VOTADOR_FALLO(c) ((therm_mapa_t) (1ull << (c)))
+#define VOTADOR_FALLOS_GRUPO(g) ((therm_mapa_t) (((1ull << SENSORES_GRUPO) - 1) << ((g) * SENSORES_GRUPO)))
+#define VOTADOR_FALLOS_TODOS ((therm_mapa_t) ((1ull << THERM_NUM) - 1))
+
+typedef struct
+{
+	uint32_t muestras;                   // muestras votadas (por grupo)
+	uint32_t discrepancias[THERM_NUM];   // muestras en que cada canal discrepa (bajo la máscara)
+	uint16_t bits[THERM_NUM];            // posiciones de bit en que ha discrepado cada canal (sin máscara)
+	therm_mapa_t fallos;                 // OR de los fallos de todas las muestras
+}votador_resumen_t;
+
+// Vota el grupo g de n mensajes: escribe out[i].media_raw[g] (mayoría bit a bit)
+// y los bits del grupo en out[i].fallos (canales que discrepan de la mayoría
+// bajo mask); el resto de bits de fallos no se tocan. in y out pueden coincidir.
+// Acumula en res, que el llamante debe poner a cero.
+void votador_tmr(const mensaje *in, mensaje *out, size_t n, int g, uint16_t mask, votador_resumen_t *res);
+
+// Voto analógico del grupo g de n mensajes: out[i].media_raw[g] es la mediana
+// de los LSB del grupo (la inferior si N es par), un canal se excluye (bit en
+// out[i].fallos) cuando no está a menos de tol de al menos VOTADOR_MAYORIA - 1
+// de los otros, y out[i].media_cdeg[g] es la media en centésimas de grado de
+// los no excluidos, cada uno con su calibración (calibracion.h). Si se excluyen
+// todos, media_cdeg es la mediana de las temperaturas. tol va en LSB o en
+// centésimas de grado según unidad. res.bits no se usa.
+void votador_analogico(const mensaje *in, mensaje *out, size_t n, int g, votador_tol_t unidad, uint16_t tol,
+					   votador_resumen_t *res);
+
+// Número de canales en fallo de una muestra
+static inline int votador_num_fallos(uint32_t fallos)
+{
+	return __builtin_popcount(fallos);
+}
+
+// true si algún grupo tiene más fallos de los que permite su mayoría
+static inline bool votador_sin_mayoria(therm_mapa_t fallos)
+{
+	for (int g = 0; g < GRUPOS; g++)
+	{
+		if (votador_num_fallos(fallos & VOTADOR_FALLOS_GRUPO(g)) > SENSORES_GRUPO - VOTADOR_MAYORIA)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Mapa acumulado de sensores que han fallado desde el arranque. Lo escribe el
+// votador y lo consulta cualquier tarea (la máquina de estados al entrar en
+// SENSOR_FAILURE); devuelve true si el mapa ha cambiado.
+bool votador_marcar_fallidos(therm_mapa_t fallos);
+therm_mapa_t votador_sensores_fallidos(void);
+
+#endif
@@ -0,0 +1,178 @@
+// Microbenchmarks del pipeline (ver bench.h)
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/ringbuf.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "config.h"
+#include "term.h"
+#include "canal.h"
+#include "spsc.h"
+#include "bench.h"
+
+static const char *TAG = "STF_P1:bench";
+
+#define BENCH_LUT_ITER 200000
+// Rango de trabajo del termistor en el que se evalúa el error de las tablas.
+// Fuera de él la fórmula tiende a ±infinito y la comparación no tiene sentido.
+#define BENCH_T_MIN -40.0f
+#define BENCH_T_MAX 125.0f
+
+// Evita que el compilador elimine los bucles medidos
+static volatile float bench_sink_f;
+static volatile int32_t bench_sink_i;
+
+// Recorre el rango del ADC con un paso primo para no favorecer a la caché
+#define BENCH_LSB(i) ((uint16_t) (((i) * 7919u) & THERM_LSB_MAX))
+
+static float bench_ns(int64_t t0, int64_t t1, int iter)
+{
+	return (float) (t1 - t0) * 1000.0f / iter;
+}
+
+void bench_lut(void)
+{
+	ESP_ERROR_CHECK(therm_lut_init());
+
+	// Precisión frente a la fórmula Beta original
+	float err_lut = 0.0f;
+	float err_fx = 0.0f;
+	double sq_fx = 0.0;
+	int n = 0;
+	for (int lsb = 0; lsb <= THERM_LSB_MAX; lsb++)
+	{
+		float ref = convert_lsb_t_formula(lsb);
+		if (ref < BENCH_T_MIN || ref > BENCH_T_MAX)
+		{
+			continue;
+		}
+		float e_lut = fabsf(convert_lsb_t(lsb) - ref);
+		float e_fx = fabsf(convert_lsb_cdeg(lsb) / 100.0f - ref);
+		if (e_lut > err_lut) err_lut = e_lut;
+		if (e_fx > err_fx) err_fx = e_fx;
+		sq_fx += (double) e_fx * e_fx;
+		n++;
+	}
+	ESP_LOGI(TAG, "LUT precision [%.0f, %.0f] C, %d valores: float max %.6f C; punto fijo max %.4f C, rms %.4f C",
+			 BENCH_T_MIN, BENCH_T_MAX, n, err_lut, err_fx, sqrt(sq_fx / n));
+
+	// Coste por conversión
+	float acc = 0.0f;
+	int64_t t0 = esp_timer_get_time();
+	for (int i = 0; i < BENCH_LUT_ITER; i++)
+	{
+		acc += convert_lsb_t_formula(BENCH_LSB(i));
+	}
+	int64_t t1 = esp_timer_get_time();
+	bench_sink_f = acc;
+
+	acc = 0.0f;
+	int64_t t2 = esp_timer_get_time();
+	for (int i = 0; i < BENCH_LUT_ITER; i++)
+	{
+		acc += convert_lsb_t(BENCH_LSB(i));
+	}
+	int64_t t3 = esp_timer_get_time();
+	bench_sink_f = acc;
+
+	int32_t acc_fx = 0;
+	int64_t t4 = esp_timer_get_time();
+	for (int i = 0; i < BENCH_LUT_ITER; i++)
+	{
+		acc_fx += convert_lsb_cdeg(BENCH_LSB(i));
+	}
+	int64_t t5 = esp_timer_get_time();
+	bench_sink_i = acc_fx;
+
+	ESP_LOGI(TAG, "LUT coste por conversion: formula %.1f ns; tabla float %.1f ns; punto fijo %.1f ns",
+			 bench_ns(t0, t1, BENCH_LUT_ITER), bench_ns(t2, t3, BENCH_LUT_ITER), bench_ns(t4, t5, BENCH_LUT_ITER));
+}
+
+#define BENCH_CANAL_BLOCKS 20000
+#define BENCH_CANAL_BATCH 8 // mensajes por bloque
+
+typedef struct
+{
+	canal_t *canal;
+	SemaphoreHandle_t done;
+	volatile uint32_t checksum;
+}bench_canal_ctx_t;
+
+static void bench_canal_consumer(void *arg)
+{
+	bench_canal_ctx_t *ctx = (bench_canal_ctx_t *) arg;
+	uint32_t checksum = 0;
+	size_t len;
+
+	for (int i = 0; i < BENCH_CANAL_BLOCKS; i++)
+	{
+		mensaje *block = canal_receive(ctx->canal, &len, portMAX_DELAY);
+		checksum += block[0].seq + block[len / sizeof(mensaje) - 1].seq;
+		canal_return(ctx->canal, block);
+	}
+	ctx->checksum = checksum;
+	xSemaphoreGive(ctx->done);
+	vTaskDelete(NULL);
+}
+
+static void bench_canal_one(const char *name, canal_t *canal)
+{
+	bench_canal_ctx_t ctx = { .canal = canal, .done = xSemaphoreCreateBinary() };
+	void *ptr;
+
+	xTaskCreatePinnedToCore(bench_canal_consumer, "bench_cons", 3072, &ctx, uxTaskPriorityGet(NULL), NULL, CORE1);
+
+	int64_t t0 = esp_timer_get_time();
+	for (int i = 0; i < BENCH_CANAL_BLOCKS; i++)
+	{
+		canal_send_acquire(canal, &ptr, BENCH_CANAL_BATCH * sizeof(mensaje), portMAX_DELAY);
+		mensaje *block = (mensaje *) ptr;
+		for (int j = 0; j < BENCH_CANAL_BATCH; j++)
+		{
+			block[j].seq = i;
+		}
+		canal_send_complete(canal, ptr);
+	}
+	xSemaphoreTake(ctx.done, portMAX_DELAY);
+	int64_t t1 = esp_timer_get_time();
+	vSemaphoreDelete(ctx.done);
+
+	float secs = (t1 - t0) / 1e6f;
+	ESP_LOGI(TAG, "Canal %s: %d bloques de %d mensajes en %.3f s; %.0f bloques/s, %.0f mensajes/s, %.2f us/bloque",
+			 name, BENCH_CANAL_BLOCKS, BENCH_CANAL_BATCH, secs, BENCH_CANAL_BLOCKS / secs,
+			 BENCH_CANAL_BLOCKS * BENCH_CANAL_BATCH / secs, (t1 - t0) / (float) BENCH_CANAL_BLOCKS);
+}
+
+void bench_canal(void)
+{
+	canal_t canal;
+
+	RingbufHandle_t rbuf = xRingbufferCreate(BUFFER_SIZE, BUFFER_TYPE);
+	canal_init_ringbuf(&canal, rbuf);
+	bench_canal_one("ringbuf", &canal);
+	vRingbufferDelete(rbuf);
+
+	spsc_t spsc;
+	const uint32_t slot_size = BENCH_CANAL_BATCH * sizeof(mensaje);
+	uint8_t *mem = malloc(SPSC_STORAGE_SIZE(SPSC_SLOTS, slot_size));
+	spsc_init(&spsc, mem, SPSC_SLOTS, slot_size);
+	canal_init_spsc(&canal, &spsc);
+	bench_canal_one("spsc", &canal);
+	free(mem);
+}
+
+void bench_run(void)
+{
+	ESP_LOGI(TAG, "Benchmarks (%s)", therm_get_backend()->name);
+	bench_lut();
+	bench_canal();
+}
@@ -0,0 +1,202 @@
+// Calibración por canal (ver calibracion.h)
+#include <stdio.h>
+#include <math.h>
+
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <nvs.h>
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_adc/adc_cali.h>
+#include <esp_adc/adc_cali_scheme.h>
+#endif
+
+#include "calibracion.h"
+
+static const char *TAG = "STF_P1:calibracion";
+
+#define CALIB_NVS "calib"
+
+int16_t calib_lut[THERM_NUM][THERM_LUT_SIZE];
+
+static calib_sh_t coef[THERM_NUM];
+static calib_adc_t esquema[THERM_NUM];
+static size_t ncanales = 0;
+
+#if !CONFIG_IDF_TARGET_LINUX
+static adc_cali_handle_t cali[THERM_NUM];
+
+// Calibración de fábrica del ADC para el canal; si el eFuse no la tiene se usa la recta nominal
+static calib_adc_t calib_adc_crear(therm_chan_t chan, adc_cali_handle_t *h)
+{
+	*h = NULL;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+	adc_cali_curve_fitting_config_t curva = {
+		.unit_id = chan.unit,
+		.chan = chan.channel,
+		.atten = THERM_ADC_ATTEN,
+		.bitwidth = ADC_BITWIDTH_12,
+	};
+	if (adc_cali_create_scheme_curve_fitting(&curva, h) == ESP_OK)
+	{
+		return CALIB_ADC_CURVA;
+	}
+#endif
+#if ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+	adc_cali_line_fitting_config_t recta = {
+		.unit_id = chan.unit,
+		.atten = THERM_ADC_ATTEN,
+		.bitwidth = ADC_BITWIDTH_12,
+	};
+	if (adc_cali_create_scheme_line_fitting(&recta, h) == ESP_OK)
+	{
+		return CALIB_ADC_LINEA;
+	}
+#endif
+	return CALIB_ADC_RECTA_NOMINAL;
+}
+#endif
+
+// Tensión en mV para un valor del ADC del canal
+static float calib_mv(int canal, int lsb)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+	int mv;
+	if (cali[canal] != NULL && adc_cali_raw_to_voltage(cali[canal], lsb, &mv) == ESP_OK)
+	{
+		return mv;
+	}
+#endif
+	return lsb * (float) CALIB_VCC_MV / THERM_LSB_MAX;
+}
+
+// Steinhart–Hart en centésimas de grado, saturando en los extremos (ADC en
+// cortocircuito o en circuito abierto)
+static int16_t calib_sh_cdeg(const calib_sh_t *sh, float mv)
+{
+	if (mv <= 0.0f)
+	{
+		return INT16_MIN;
+	}
+	if (mv >= CALIB_VCC_MV)
+	{
+		return INT16_MAX;
+	}
+	float l = logf(sh->r_serie * (CALIB_VCC_MV - mv) / mv);
+	float cdeg = (1.0f / (sh->a + sh->b * l + sh->c * l * l * l) - 273.15f) * 100.0f;
+	if (!(cdeg < INT16_MAX)) return INT16_MAX;
+	if (cdeg < INT16_MIN) return INT16_MIN;
+	return (int16_t) lroundf(cdeg);
+}
+
+// Mientras se rehace la tabla, cada entrada vale la antigua o la nueva
+static void calib_tabla(int canal)
+{
+	for (int lsb = 0; lsb < THERM_LUT_SIZE; lsb++)
+	{
+		calib_lut[canal][lsb] = calib_sh_cdeg(&coef[canal], calib_mv(canal, lsb));
+	}
+}
+
+calib_sh_t calib_sh_beta(float beta, float r0, float t0_k)
+{
+	// 1/T = 1/T0 + (1/B) ln(R/R0) = (1/T0 - ln(R0)/B) + (1/B) ln R
+	calib_sh_t sh = {1.0f / t0_k - logf(r0) / beta, 1.0f / beta, 0.0f, SERIES_RESISTANCE};
+	return sh;
+}
+
+static void calib_clave(int canal, char *clave, size_t len)
+{
+	snprintf(clave, len, "sh%d", canal);
+}
+
+esp_err_t calib_init(const therm_chan_t *channels, size_t n)
+{
+	if (n == 0 || n > THERM_NUM)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	ncanales = n;
+
+	nvs_handle_t nvs;
+	bool con_nvs = (nvs_open(CALIB_NVS, NVS_READONLY, &nvs) == ESP_OK);
+	for (int c = 0; c < (int) n; c++)
+	{
+		coef[c] = calib_sh_beta(BETA_COEFFICIENT, NOMINAL_RESISTANCE, NOMINAL_TEMPERATURE);
+		if (con_nvs)
+		{
+			char clave[NVS_KEY_NAME_MAX_SIZE];
+			size_t len = sizeof(coef[c]);
+			calib_clave(c, clave, sizeof(clave));
+			calib_sh_t sh;
+			if (nvs_get_blob(nvs, clave, &sh, &len) == ESP_OK && len == sizeof(sh))
+			{
+				coef[c] = sh;
+			}
+		}
+#if CONFIG_IDF_TARGET_LINUX
+		esquema[c] = CALIB_ADC_RECTA_NOMINAL;
+#else
+		esquema[c] = calib_adc_crear(channels[c], &cali[c]);
+#endif
+		calib_tabla(c);
+	}
+	if (con_nvs)
+	{
+		nvs_close(nvs);
+	}
+	calib_volcar();
+	return ESP_OK;
+}
+
+esp_err_t calib_set(int canal, const calib_sh_t *sh)
+{
+	if (canal < 0 || canal >= (int) ncanales)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	nvs_handle_t nvs;
+	esp_err_t ret = nvs_open(CALIB_NVS, NVS_READWRITE, &nvs);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	char clave[NVS_KEY_NAME_MAX_SIZE];
+	calib_clave(canal, clave, sizeof(clave));
+	ret = nvs_set_blob(nvs, clave, sh, sizeof(*sh));
+	if (ret == ESP_OK)
+	{
+		ret = nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+
+	// Solo se aplican si quedan guardados: lo que se usa es lo que habrá tras reiniciar
+	if (ret == ESP_OK)
+	{
+		coef[canal] = *sh;
+		calib_tabla(canal);
+	}
+	return ret;
+}
+
+calib_sh_t calib_get(int canal)
+{
+	return coef[canal];
+}
+
+calib_adc_t calib_adc(int canal)
+{
+	return esquema[canal];
+}
+
+void calib_volcar(void)
+{
+	static const char *nombre[] = {"recta nominal", "eFuse recta", "eFuse curva"};
+	for (int c = 0; c < (int) ncanales; c++)
+	{
+		// La temperatura a media escala permite comparar los canales de un vistazo
+		ESP_LOGI(TAG, "Canal %d: ADC %s; SH a %.6e b %.6e c %.6e, R serie %.0f; T(%d) = %.2f C", c,
+				 nombre[esquema[c]], coef[c].a, coef[c].b, coef[c].c, coef[c].r_serie,
+				 THERM_LUT_SIZE / 2, calib_t(c, THERM_LUT_SIZE / 2));
+	}
+}
@@ -0,0 +1,109 @@
+// Etapa de filtrado y diezmado (ver filtro.h)
+#include <string.h>
+
+#include "filtro.h"
+
+esp_err_t filtro_init(filtro_t *f, const filtro_cfg_t *cfg, size_t ncanales)
+{
+	if (ncanales == 0 || ncanales > FILTRO_MAX_CANALES || cfg->decimacion == 0 ||
+		cfg->k == 0 || cfg->k > FILTRO_MAX_K || cfg->shift > 15)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	memset(f, 0, sizeof(*f));
+	f->cfg = *cfg;
+	f->ncanales = ncanales;
+	return ESP_OK;
+}
+
+// Mediana de las n muestras de la ventana (ordenación por inserción: n <= FILTRO_MAX_K)
+static uint16_t filtro_mediana(const uint16_t *v, size_t n)
+{
+	uint16_t tmp[FILTRO_MAX_K];
+
+	for (size_t i = 0; i < n; i++)
+	{
+		uint16_t x = v[i];
+		size_t j = i;
+		while (j > 0 && tmp[j - 1] > x)
+		{
+			tmp[j] = tmp[j - 1];
+			j--;
+		}
+		tmp[j] = x;
+	}
+	return tmp[n / 2];
+}
+
+bool filtro_muestra(filtro_t *f, const uint16_t *lsb, uint16_t *out)
+{
+	const uint8_t k = f->cfg.k;
+	const uint8_t shift = f->cfg.shift;
+	const bool lleno = (f->llenos == k);
+
+	for (size_t c = 0; c < f->ncanales; c++)
+	{
+		uint16_t x = lsb[c];
+		switch (f->cfg.tipo)
+		{
+		case FILTRO_MEDIA:
+			// La suma se actualiza con la muestra que entra y la que sale de la ventana
+			if (lleno)
+			{
+				f->suma[c] -= f->ventana[c][f->pos];
+			}
+			f->suma[c] += x;
+			f->ventana[c][f->pos] = x;
+			break;
+		case FILTRO_MEDIANA:
+			f->ventana[c][f->pos] = x;
+			break;
+		case FILTRO_IIR:
+			// Se arranca en la primera muestra para no partir de cero
+			if (f->llenos == 0)
+			{
+				f->iir[c] = (uint32_t) x << shift;
+			}
+			else
+			{
+				f->iir[c] += x - (f->iir[c] >> shift);
+			}
+			break;
+		default:
+			f->ventana[c][0] = x;
+			break;
+		}
+	}
+	f->pos = (f->pos + 1 == k) ? 0 : f->pos + 1;
+	if (!lleno)
+	{
+		f->llenos++;
+	}
+
+	if (++f->cuenta < f->cfg.decimacion)
+	{
+		return false;
+	}
+	f->cuenta = 0;
+
+	// Solo se calcula la salida de las muestras que se emiten
+	for (size_t c = 0; c < f->ncanales; c++)
+	{
+		switch (f->cfg.tipo)
+		{
+		case FILTRO_MEDIA:
+			out[c] = (f->suma[c] + f->llenos / 2) / f->llenos;
+			break;
+		case FILTRO_MEDIANA:
+			out[c] = filtro_mediana(f->ventana[c], f->llenos);
+			break;
+		case FILTRO_IIR:
+			out[c] = (f->iir[c] + ((1u << shift) >> 1)) >> shift;
+			break;
+		default:
+			out[c] = f->ventana[c][0];
+			break;
+		}
+	}
+	return true;
+}
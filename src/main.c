@@ -24,14 +24,110 @@
 // esp-idf
 #include <esp_log.h>
 #include <esp_event.h>
+#include <esp_system.h>
 #include <nvs_flash.h>
 
 // propias
 #include "config.h"
 #include "system.h"
+#include "term.h"
+#include "bench.h"
+#include "traza.h"
+#include "registro.h"
+#include "votador.h"
+#include "calibracion.h"
 
 static const char *TAG = "STF_P1:main";
 
+#if CANAL_TIPO == CANAL_SPSC
+// Colas SPSC entre sensor y votador y entre votador y monitor, con su almacenamiento
+#define SPSC_SLOT_SIZE (MSG_BATCH_MAX * sizeof(mensaje))
+static spsc_t spsc_votador;
+static spsc_t spsc_monitor;
+static uint8_t spsc_votador_mem[SPSC_STORAGE_SIZE(SPSC_SLOTS, SPSC_SLOT_SIZE)] __attribute__((aligned(4)));
+static uint8_t spsc_monitor_mem[SPSC_STORAGE_SIZE(SPSC_SLOTS, SPSC_SLOT_SIZE)] __attribute__((aligned(4)));
+#endif
+
+// Máquina de estados, tareas y canales. Las tareas guardan punteros a todos ellos,
+// así que no pueden vivir en la pila de app_main (que además no tiene sitio para
+// system_t y los tres system_task_t, cada uno con su TCB)
+static system_t sys_stf_p1;
+static system_task_t task_sensor;
+static system_task_t task_monitor;
+static system_task_t task_votador;
+static canal_t rbuf_votador;
+static canal_t rbuf_monitor;
+
+#if MEMORIA_ESTATICA
+// Pilas de las tareas del pipeline (el TCB va dentro de cada system_task_t)
+SYSTEM_TASK_STACK(pila_sensor, TASK_SENSOR_STACK_SIZE);
+SYSTEM_TASK_STACK(pila_monitor, TASK_MONITOR_STACK_SIZE);
+SYSTEM_TASK_STACK(pila_votador, TASK_VOTADOR_STACK_SIZE);
+#define PILA(p) (p)
+#if CANAL_TIPO != CANAL_SPSC
+// Almacenamiento de los buffers cíclicos
+static uint8_t rbuf_votador_mem[BUFFER_SIZE] __attribute__((aligned(4)));
+static uint8_t rbuf_monitor_mem[BUFFER_SIZE] __attribute__((aligned(4)));
+static StaticRingbuffer_t rbuf_votador_buf;
+static StaticRingbuffer_t rbuf_monitor_buf;
+#endif
+#else
+#define PILA(p) NULL
+#endif
+
+// Crea una tarea del pipeline con la pila reservada en compilación o desde el heap
+static void arrancar_tarea(system_t *sys, system_task_t *task, TaskFunction_t fn, const char *nombre,
+						   StackType_t *pila, configSTACK_DEPTH_TYPE tam, void *args, BaseType_t core)
+{
+#if MEMORIA_ESTATICA
+	system_task_start_static_in_core(sys, task, fn, nombre, pila, tam, args, 0, core);
+#else
+	system_task_start_in_core(sys, task, fn, nombre, tam, args, 0, core);
+#endif
+}
+
+// Resumen de la memoria que reservan tareas, canales y registro. Todo sale de
+// constantes de config.h, así que es el mismo en cada arranque; con
+// MEMORIA_ESTATICA está fuera del heap y el heap libre no cambia al crear tareas.
+static void memoria_presupuesto(void)
+{
+	size_t pilas = TASK_SENSOR_STACK_SIZE + TASK_MONITOR_STACK_SIZE + TASK_VOTADOR_STACK_SIZE;
+	// Con MEMORIA_ESTATICA el TCB de las tareas del pipeline va dentro de su system_task_t
+	size_t tcbs = MEMORIA_ESTATICA ? 0 : 3 * sizeof(StaticTask_t);
+	// La máquina de estados y los descriptores de las tareas son siempre estáticos
+	size_t sistema = sizeof(system_t) + 3 * sizeof(system_task_t);
+#if CANAL_TIPO == CANAL_SPSC
+	size_t canales = 2 * (SPSC_STORAGE_SIZE(SPSC_SLOTS, SPSC_SLOT_SIZE) + sizeof(spsc_t));
+#else
+	size_t canales = 2 * (BUFFER_SIZE + sizeof(StaticRingbuffer_t));
+#endif
+	size_t registro = 0;
+#if REGISTRO_ENABLE
+	pilas += REGISTRO_STACK_SIZE;
+	tcbs += sizeof(StaticTask_t);
+	registro = REGISTRO_PAGINAS * (REGISTRO_PAGINA_BYTES + sizeof(void *)) + 2 * sizeof(StaticQueue_t);
+#endif
+#if INFORME_PERIODO_MS > 0
+	pilas += SYSTEM_REPORTER_STACK_SIZE;
+	tcbs += sizeof(StaticTask_t);
+#endif
+	ESP_LOGI(TAG, "Memoria (%s): pilas %u; TCB %u; canales %u; registro %u; total %u bytes",
+			 MEMORIA_ESTATICA ? "estatica" : "heap", (unsigned) pilas, (unsigned) tcbs, (unsigned) canales,
+			 (unsigned) registro, (unsigned) (pilas + tcbs + canales + registro));
+	ESP_LOGI(TAG, "Memoria: system_t %u + 3 x system_task_t %u = %u bytes (siempre estaticos)",
+			 (unsigned) sizeof(system_t), (unsigned) sizeof(system_task_t), (unsigned) sistema);
+	ESP_LOGI(TAG, "Memoria: tablas de conversion %u bytes (nominal %u, calibracion %u; siempre estaticas)",
+			 (unsigned) (therm_lut_bytes() + sizeof(calib_lut)), (unsigned) therm_lut_bytes(),
+			 (unsigned) sizeof(calib_lut));
+}
+
+// Guarda de las transiciones que salen de TOTAL_FAILURE: es un estado terminal,
+// las tareas ya están detenidas y no se debe volver a entrar en él ni abandonarlo
+static bool guarda_terminal(system_t *sys, uint8_t from, uint8_t to)
+{
+	return false;
+}
+
 // Punto de entrada
 void app_main(void)
 {
@@ -40,29 +136,31 @@ void app_main(void)
 	// Nuestra máquina de estados solo tiene dos; INIT: un estado transitorio de inicialización de 
 	// los procesos sensor y monitor (un productor y un consumidor); y SENSOR_LOOP: un estado estacionario 
 	// en el que se queda idefinidamente una vez todo está funcionando.
-	system_t sys_stf_p1;
 	ESP_LOGI(TAG,"Starting STF_P1 system");
 	system_create(&sys_stf_p1, SYS_NAME);
 	system_register_state(&sys_stf_p1, INIT);
 	system_register_state(&sys_stf_p1, SENSOR_LOOP);
-	system_register_state(&sys_stf_p1, SENSOR1_FAILURE);
-	system_register_state(&sys_stf_p1, SENSOR2_FAILURE);
-	system_register_state(&sys_stf_p1, SENSOR3_FAILURE);
+	system_register_state(&sys_stf_p1, SENSOR_FAILURE);
 	system_register_state(&sys_stf_p1, TOTAL_FAILURE);
+	system_register_transition(&sys_stf_p1, TOTAL_FAILURE, SYSTEM_ANY_STATE, guarda_terminal, NULL);
 	system_set_default_state(&sys_stf_p1, INIT);
 
 
-	// Define manejadores de tareas (de momento sin asignar)
-	system_task_t task_sensor;
-	system_task_t task_monitor;
-	system_task_t task_votador;
-
-	// Define y crea dos buffers cíclicos par ambas tareas, tienen el noimbre de la tarea que lee
-	RingbufHandle_t rbuf_votador;
-	rbuf_votador = xRingbufferCreate(BUFFER_SIZE, BUFFER_TYPE);
-
-	RingbufHandle_t rbuf_monitor;
-	rbuf_monitor = xRingbufferCreate(BUFFER_SIZE, BUFFER_TYPE);
+	// Crea dos buffers cíclicos par ambas tareas, tienen el noimbre de la tarea que lee
+	// El tipo de transporte se elige con CANAL_TIPO en config.h
+#if CANAL_TIPO == CANAL_SPSC
+	spsc_init(&spsc_votador, spsc_votador_mem, SPSC_SLOTS, SPSC_SLOT_SIZE);
+	spsc_init(&spsc_monitor, spsc_monitor_mem, SPSC_SLOTS, SPSC_SLOT_SIZE);
+	canal_init_spsc(&rbuf_votador, &spsc_votador);
+	canal_init_spsc(&rbuf_monitor, &spsc_monitor);
+#elif MEMORIA_ESTATICA
+	canal_init_ringbuf(&rbuf_votador, xRingbufferCreateStatic(BUFFER_SIZE, BUFFER_TYPE, rbuf_votador_mem, &rbuf_votador_buf));
+	canal_init_ringbuf(&rbuf_monitor, xRingbufferCreateStatic(BUFFER_SIZE, BUFFER_TYPE, rbuf_monitor_mem, &rbuf_monitor_buf));
+#else
+	canal_init_ringbuf(&rbuf_votador, xRingbufferCreate(BUFFER_SIZE, BUFFER_TYPE));
+	canal_init_ringbuf(&rbuf_monitor, xRingbufferCreate(BUFFER_SIZE, BUFFER_TYPE));
+#endif
+	memoria_presupuesto();
 
 	// variable para códigos de retorno 
 	esp_err_t ret;
@@ -77,45 +175,84 @@ void app_main(void)
 			STATE_BEGIN();
 			ESP_LOGI(TAG, "State: INIT");
 
-            // Este código se utiliza para inicializar una memoria no volátil del ESP32, 
-			// es útil cuando queremos almacenar información de nuestro sistema entre 
-			// apagados, es decir, persistencia. 
-			// Un ejemplo típico es almacenar en NVS una ESSID y PASS de una red WIFI establecida 
-			// "en caliente" desde una web mínima que levanta el dispositivo en el primer encendido
-			// De momento no lo estamos usando en el proyecto. 
-            ret = nvs_flash_init();
-            if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) 
-            {
-                ESP_ERROR_CHECK(nvs_flash_erase());
-                ESP_ERROR_CHECK(nvs_flash_init());
-            }
+			int64_t init_us = esp_timer_get_time();
+
+#if THERM_SIMULADO || CONFIG_IDF_TARGET_LINUX
+			// Sin ADC real: reproduce una traza grabada o, si no existe, una señal sintética
+			const therm_chan_t therm_channels[THERM_NUM] = THERM_CANALES;
+			therm_set_backend(&therm_backend_sim);
+			therm_sim_load_csv(THERM_SIM_TRAZA, therm_channels, THERM_NUM);
+#endif
+
+#if BENCH_ENABLE
+			bench_run();
+#endif
+
+			// Las tres tareas se crean seguidas: cada una se prepara por su cuenta y
+			// queda bloqueada en TASK_READY() hasta que main abre la barrera de arranque,
+			// de modo que nadie produce antes de que el resto pueda consumir.
 
 			// Crea la tarea sensor como un proceso asociado al CORE 0. 
 			// Lo que hace la tarea está en task_sensor.h
             ESP_LOGI(TAG, "starting sensor task...");
-            task_sensor_args_t task_sensor_args = {&rbuf_votador, 1};
-			system_task_start_in_core(&sys_stf_p1, &task_sensor, TASK_SENSOR, "TASK_SENSOR", TASK_SENSOR_STACK_SIZE, &task_sensor_args, 0, CORE0);
-			ESP_LOGI(TAG, "Done");
-
-			// Delay
-			vTaskDelay(pdMS_TO_TICKS(1000));
+            static task_sensor_args_t task_sensor_args = {&rbuf_votador, SENSOR_PERIODO_NS, SENSOR_ACQ, SENSOR_INTERPOLAR, SENSOR_CONT_FREQ_HZ, SENSOR_BATCH,
+				{SENSOR_FILTRO, SENSOR_FILTRO_K, SENSOR_FILTRO_SHIFT, SENSOR_DECIMACION}};
+			arrancar_tarea(&sys_stf_p1, &task_sensor, TASK_SENSOR, "TASK_SENSOR", PILA(pila_sensor), TASK_SENSOR_STACK_SIZE, &task_sensor_args, CORE0);
 
 			// Crea la tarea monitor como un proceso asociado al CORE 1.
 			// Lo que hace la tarea está en task_monitor.c
 			ESP_LOGI(TAG, "starting monitor task...");
-			task_monitor_args_t task_monitor_args = {&rbuf_monitor};
-			system_task_start_in_core(&sys_stf_p1, &task_monitor, TASK_MONITOR, "TASK_MONITOR", TASK_MONITOR_STACK_SIZE, &task_monitor_args, 0, CORE1);
-			ESP_LOGI(TAG, "Done");
-
-			// Delay
-			vTaskDelay(pdMS_TO_TICKS(1000));
+			static task_monitor_args_t task_monitor_args = {&rbuf_monitor, MONITOR_VENTANA_MS, MONITOR_LOG_MUESTRAS, MONITOR_LOG_MS, TELEMETRIA_ENABLE};
+			arrancar_tarea(&sys_stf_p1, &task_monitor, TASK_MONITOR, "TASK_MONITOR", PILA(pila_monitor), TASK_MONITOR_STACK_SIZE, &task_monitor_args, CORE1);
+			system_task_set_queue(&task_monitor, canal_ocupacion, &rbuf_monitor);
 
 			// Crea la tarea votador como un proceso asociado al CORE 1.
 			// Lo que hace la tarea está en task_votador.c
 			ESP_LOGI(TAG, "starting votador task...");
-			task_votador_args_t task_votador_args = {&rbuf_votador, &rbuf_monitor, THERM_MASK};
-			system_task_start_in_core(&sys_stf_p1, &task_votador, TASK_VOTADOR, "TASK_VOTADOR", TASK_VOTADOR_STACK_SIZE, &task_votador_args, 0, CORE1);
-			ESP_LOGI(TAG, "Done");
+			static task_votador_args_t task_votador_args = {&rbuf_votador, &rbuf_monitor, THERM_MASK, VOTADOR_BATCH, VOTADOR_MODO, VOTADOR_TOL_UNIDAD, VOTADOR_TOL, VOTADOR_HISTERESIS};
+			arrancar_tarea(&sys_stf_p1, &task_votador, TASK_VOTADOR, "TASK_VOTADOR", PILA(pila_votador), TASK_VOTADOR_STACK_SIZE, &task_votador_args, CORE1);
+			system_task_set_queue(&task_votador, canal_ocupacion, &rbuf_votador);
+
+            // Mientras las tareas inicializan ADC, filtros y telemetría, main prepara
+			// la memoria no volátil del ESP32, útil cuando queremos almacenar información
+			// de nuestro sistema entre apagados, es decir, persistencia. 
+			// Un ejemplo típico es almacenar en NVS una ESSID y PASS de una red WIFI establecida 
+			// "en caliente" desde una web mínima que levanta el dispositivo en el primer encendido
+			// Aquí se usa para el contador de arranques del registro de muestras (registro.h).
+            ret = nvs_flash_init();
+            if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) 
+            {
+                ESP_ERROR_CHECK(nvs_flash_erase());
+                ESP_ERROR_CHECK(nvs_flash_init());
+            }
+
+#if REGISTRO_ENABLE
+			// Historial de muestras en flash; necesita la NVS para contar los arranques
+			registro_init(CORE0);
+#endif
+
+			// Tablas de conversión LSB -> °C: la nominal y una por canal con su
+			// calibración (NVS y eFuse del ADC), compartidas por votador y monitor.
+			// Nadie convierte antes de abrir la barrera.
+			ESP_ERROR_CHECK(therm_lut_init());
+			const therm_chan_t canales[THERM_NUM] = THERM_CANALES;
+			ESP_ERROR_CHECK(calib_init(canales, THERM_NUM));
+
+			// Barrera de arranque: con todo listo se liberan las tres tareas a la vez. Si
+			// alguna no llega a tiempo se arranca igualmente; el aviso queda en el log.
+			system_task_t *const tareas[] = {&task_sensor, &task_monitor, &task_votador};
+			system_wait_ready(&sys_stf_p1, tareas, 3, TASK_READY_TIMEOUT_MS);
+			system_release(&sys_stf_p1);
+			int64_t listo_us = esp_timer_get_time();
+			ESP_LOGI(TAG, "Arranque: INIT en %u ms, %u ms desde el reset", (unsigned) ((listo_us - init_us) / 1000),
+					 (unsigned) (listo_us / 1000));
+
+#if INFORME_PERIODO_MS > 0
+			// Informe periódico de recursos de las tareas
+			system_reporter_start(&sys_stf_p1, INFORME_PERIODO_MS, CORE0);
+#endif
+			ESP_LOGI(TAG, "Heap libre %u bytes (minimo %u)", (unsigned) esp_get_free_heap_size(),
+					 (unsigned) esp_get_minimum_free_heap_size());
 
 			// Esta macro provoca el cambio de estado a SENSOR_LOOP, en este caso. 
 			// system.h define una macro para cambiar de estado desde una tarea externa
@@ -132,25 +269,21 @@ void app_main(void)
 			ESP_LOGI(TAG, "State: SENSOR_LOOP");
 			STATE_END();
 		}
-		STATE(SENSOR1_FAILURE)
-		{
-			STATE_BEGIN();
-			// La máquina queda en este estado de forma indefinida. 
-			ESP_LOGI(TAG, "State: SENSOR1_FAILURE");
-			STATE_END();
-		}
-		STATE(SENSOR2_FAILURE)
+		STATE(SENSOR_FAILURE)
 		{
 			STATE_BEGIN();
-			// La máquina queda en este estado de forma indefinida. 
-			ESP_LOGI(TAG, "State: SENSOR2_FAILURE");
-			STATE_END();
-		}
-		STATE(SENSOR3_FAILURE)
-		{
-			STATE_BEGIN();
-			// La máquina queda en este estado de forma indefinida. 
-			ESP_LOGI(TAG, "State: SENSOR3_FAILURE");
+			// La máquina queda en este estado de forma indefinida. Qué sensores han
+			// fallado lo dice el mapa del votador (bit c = sensor c + 1)
+			therm_mapa_t fallidos = votador_sensores_fallidos();
+			ESP_LOGI(TAG, "State: SENSOR_FAILURE (sensores 0x%0*X)", (THERM_NUM + 3) / 4, (unsigned) fallidos);
+			for (int c = 0; c < THERM_NUM; c++)
+			{
+				if (fallidos & VOTADOR_FALLO(c))
+				{
+					ESP_LOGW(TAG, "  sensor %d del grupo %d en fallo", c + 1, c / SENSORES_GRUPO);
+				}
+			}
+			traza_solicitar_volcado();
 			STATE_END();
 		}
 		STATE(TOTAL_FAILURE)
@@ -158,9 +291,15 @@ void app_main(void)
 			STATE_BEGIN();
 			// La máquina queda en este estado de forma indefinida. 
 			ESP_LOGI(TAG, "State: ERROR");
-			system_task_stop(&sys_stf_p1, &task_votador, TASK_VOTADOR_TIMEOUT_MS);
-			system_task_stop(&sys_stf_p1, &task_sensor, TASK_SENSOR_TIMEOUT_MS);
-			system_task_stop(&sys_stf_p1, &task_monitor, TASK_MONITOR_TIMEOUT_MS);
+			// Último volcado de latencias antes de parar el monitor
+			traza_solicitar_volcado();
+			// El informe periódico lee los handles de las tareas: se detiene antes que ellas
+			system_reporter_stop();
+			system_report(&sys_stf_p1);
+			// Las tres tareas se detienen en paralelo, con un único plazo
+			system_task_t *const tareas[] = {&task_votador, &task_sensor, &task_monitor};
+			system_task_stop_all(&sys_stf_p1, tareas, 3, TASK_STOP_ALL_TIMEOUT_MS);
+			system_print_stats(&sys_stf_p1);
 			STATE_END();
 		}
 		STATE_MACHINE_END();
@@ -0,0 +1,214 @@
+// Planificador del muestreo (ver muestreo.h)
+#include <string.h>
+#include <stdatomic.h>
+
+#include <sdkconfig.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_attr.h>
+#include <driver/gptimer.h>
+#endif
+
+#include "muestreo.h"
+
+static const char *TAG = "STF_P1:muestreo";
+
+// Resolución del gptimer: 10 MHz, un paso cada 100 ns
+#define MUESTREO_RESOLUCION_HZ 10000000u
+#define MUESTREO_PASO_NS (1000000000u / MUESTREO_RESOLUCION_HZ)
+
+static TaskHandle_t tarea = NULL;
+static muestreo_stats_t stats;
+
+// Escritos por la ISR (o el callback del esp_timer)
+static volatile uint32_t isr_ticks = 0;  // ticks vencidos
+static volatile int64_t isr_us = 0;      // instante del último
+static volatile int64_t primero_us = 0;  // instante del primero: fija la fase
+
+// Último tick atendido por la tarea
+static uint32_t atendido = 0;
+
+// Petición de despertar (parada de la tarea)
+static atomic_bool parar = false;
+
+#if CONFIG_IDF_TARGET_LINUX
+static esp_timer_handle_t tmr = NULL;
+
+static void muestreo_tick(void *arg)
+{
+	int64_t ahora = esp_timer_get_time();
+	if (isr_ticks == 0)
+	{
+		primero_us = ahora;
+	}
+	isr_us = ahora;
+	isr_ticks++;
+	xTaskNotifyGiveIndexed(tarea, MUESTREO_NOTIFY_INDEX);
+}
+#else
+static gptimer_handle_t tmr = NULL;
+
+static bool IRAM_ATTR muestreo_isr(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *arg)
+{
+	int64_t ahora = esp_timer_get_time();
+	if (isr_ticks == 0)
+	{
+		primero_us = ahora;
+	}
+	isr_us = ahora;
+	isr_ticks++;
+	BaseType_t despertar = pdFALSE;
+	vTaskNotifyGiveIndexedFromISR(tarea, MUESTREO_NOTIFY_INDEX, &despertar);
+	return despertar == pdTRUE;
+}
+#endif
+
+esp_err_t muestreo_start(uint32_t periodo_ns)
+{
+	if (periodo_ns < MUESTREO_PERIODO_MIN_NS || tmr != NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	tarea = xTaskGetCurrentTaskHandle();
+	isr_ticks = 0;
+	atendido = 0;
+	atomic_store(&parar, false);
+	muestreo_reset_stats();
+	stats.periodo_ns = periodo_ns;
+	// Descarta notificaciones antiguas de esta entrada
+	ulTaskNotifyTakeIndexed(MUESTREO_NOTIFY_INDEX, pdTRUE, 0);
+
+#if CONFIG_IDF_TARGET_LINUX
+	const esp_timer_create_args_t args = {
+		.callback = &muestreo_tick,
+		.name = "muestreo"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&args, &tmr));
+	ESP_LOGI(TAG, "esp_timer, periodo %u us", (unsigned) (periodo_ns / 1000));
+	return esp_timer_start_periodic(tmr, periodo_ns / 1000);
+#else
+	const gptimer_config_t cfg = {
+		.clk_src = GPTIMER_CLK_SRC_DEFAULT,
+		.direction = GPTIMER_COUNT_UP,
+		.resolution_hz = MUESTREO_RESOLUCION_HZ,
+	};
+	ESP_ERROR_CHECK(gptimer_new_timer(&cfg, &tmr));
+
+	// La alarma recarga el contador a 0 en hardware: el periodo es exacto
+	// (salvo el redondeo a 100 ns) y no depende de cuándo se atienda la ISR
+	const gptimer_alarm_config_t alarma = {
+		.reload_count = 0,
+		.alarm_count = periodo_ns / MUESTREO_PASO_NS,
+		.flags.auto_reload_on_alarm = true,
+	};
+	const gptimer_event_callbacks_t cbs = {
+		.on_alarm = muestreo_isr,
+	};
+	ESP_ERROR_CHECK(gptimer_register_event_callbacks(tmr, &cbs, NULL));
+	ESP_ERROR_CHECK(gptimer_set_alarm_action(tmr, &alarma));
+	ESP_ERROR_CHECK(gptimer_enable(tmr));
+	ESP_LOGI(TAG, "gptimer, periodo %u ns", (unsigned) (alarma.alarm_count * MUESTREO_PASO_NS));
+	stats.periodo_ns = alarma.alarm_count * MUESTREO_PASO_NS;
+	return gptimer_start(tmr);
+#endif
+}
+
+bool muestreo_esperar(TickType_t timeout, uint32_t *ts_us)
+{
+	uint32_t k;
+	int64_t isr;
+	for (;;)
+	{
+		if (ulTaskNotifyTakeIndexed(MUESTREO_NOTIFY_INDEX, pdTRUE, timeout) == 0 || atomic_load(&parar))
+		{
+			return false;
+		}
+		// Lectura coherente del par (ticks, instante): la ISR puede entrar entre medias
+		do
+		{
+			k = isr_ticks;
+			isr = isr_us;
+		} while (k != isr_ticks);
+		// Si la ISR entró entre la notificación anterior y la lectura, su tick ya
+		// se atendió y esta notificación sobra
+		if (k != atendido)
+		{
+			break;
+		}
+	}
+	int64_t despierta = esp_timer_get_time();
+
+	int64_t programado = primero_us + (int64_t) (k - 1) * stats.periodo_ns / 1000;
+	stats.perdidos += k - atendido - 1;
+	stats.ticks++;
+	atendido = k;
+	// Los dos relojes no son el mismo: un adelanto de 1 us cuenta como 0
+	traza_hist_add(&stats.isr, (isr > programado) ? (uint32_t) (isr - programado) : 0);
+	traza_hist_add(&stats.tarea, (despierta > programado) ? (uint32_t) (despierta - programado) : 0);
+
+	*ts_us = (uint32_t) programado;
+	return true;
+}
+
+void muestreo_despertar(void *ctx)
+{
+	atomic_store(&parar, true);
+	if (tarea != NULL)
+	{
+		xTaskNotifyGiveIndexed(tarea, MUESTREO_NOTIFY_INDEX);
+	}
+}
+
+esp_err_t muestreo_stop(void)
+{
+	if (tmr == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+#if CONFIG_IDF_TARGET_LINUX
+	ESP_ERROR_CHECK(esp_timer_stop(tmr));
+	ESP_ERROR_CHECK(esp_timer_delete(tmr));
+#else
+	ESP_ERROR_CHECK(gptimer_stop(tmr));
+	ESP_ERROR_CHECK(gptimer_disable(tmr));
+	ESP_ERROR_CHECK(gptimer_del_timer(tmr));
+#endif
+	tmr = NULL;
+	return ESP_OK;
+}
+
+const muestreo_stats_t *muestreo_stats(void)
+{
+	return &stats;
+}
+
+void muestreo_reset_stats(void)
+{
+	uint32_t periodo_ns = stats.periodo_ns;
+	memset(&stats, 0, sizeof(stats));
+	stats.periodo_ns = periodo_ns;
+}
+
+void muestreo_volcar(void)
+{
+	ESP_LOGI(TAG, "Muestreo: periodo %u ns; ticks %u; perdidos %u",
+			 (unsigned) stats.periodo_ns, (unsigned) stats.ticks, (unsigned) stats.perdidos);
+	const traza_hist_t *h[2] = {&stats.isr, &stats.tarea};
+	const char *nombres[2] = {"isr", "tarea"};
+	for (int i = 0; i < 2; i++)
+	{
+		if (h[i]->n == 0)
+		{
+			continue;
+		}
+		ESP_LOGI(TAG, "  retraso %-5s (us) min %u; p50 %u; p99 %u; max %u", nombres[i],
+				 (unsigned) h[i]->min, (unsigned) traza_percentil(h[i], 0.50f),
+				 (unsigned) traza_percentil(h[i], 0.99f), (unsigned) h[i]->max);
+	}
+}
@@ -0,0 +1,344 @@
+// Registro circular de muestras en flash (ver registro.h)
+#include <string.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <nvs.h>
+
+#include "config.h"
+#include "registro.h"
+
+static const char *TAG = "STF_P1:registro";
+
+_Static_assert(REGISTRO_PAGINA_BYTES % sizeof(registro_muestra_t) == 0,
+			   "registro_muestra_t debe dividir la página de flash");
+
+#define REGISTRO_MAGICO 0x52465453 // "STFR"
+
+// Cabecera de sector: ocupa los primeros huecos de muestra del sector
+typedef struct
+{
+	uint32_t magico;
+	uint32_t secuencia;  // crece con cada sector abierto; el mayor es el más reciente
+	uint32_t arranque;
+	uint32_t reservado;
+	uint64_t t0_us;      // esp_timer al abrir el sector, para reconstruir los 64 bits de ts_us
+}registro_cabecera_t;
+
+#define HUECO sizeof(registro_muestra_t)
+#define CABECERA_HUECOS ((sizeof(registro_cabecera_t) + HUECO - 1) / HUECO)
+#define HUECOS_SECTOR (REGISTRO_SECTOR / HUECO)
+
+// Página de RAM que va del monitor a la tarea de escritura
+typedef struct
+{
+	size_t n;
+	registro_muestra_t m[REGISTRO_POR_PAGINA];
+}registro_pagina_t;
+
+static const esp_partition_t *particion = NULL;
+static uint32_t nsectores = 0;
+static uint32_t arranque = 0;
+
+// Estado de escritura (solo lo toca la tarea de escritura)
+static uint32_t sector = 0;
+static uint32_t secuencia = 0;
+static uint32_t hueco = HUECOS_SECTOR; // siguiente hueco libre del sector; lleno = hay que abrir otro
+
+// Páginas: el monitor rellena una y las llenas pasan a la tarea por una cola
+static registro_pagina_t paginas[REGISTRO_PAGINAS];
+static QueueHandle_t libres = NULL;
+static QueueHandle_t llenas = NULL;
+static registro_pagina_t *actual = NULL;
+static int64_t ultimo_flush = 0;
+
+// Las suman el monitor (registro_flush) y la tarea de escritura
+static atomic_uint perdidas = 0;
+static volatile uint32_t escritas = 0;
+
+// Reconstruye el instante de 64 bits a partir de los 32 bits bajos y la base del sector
+static inline uint64_t registro_t64(uint64_t t0_us, uint32_t ts_us)
+{
+	return t0_us + (int32_t) (ts_us - (uint32_t) t0_us);
+}
+
+static esp_err_t registro_abrir_sector(void)
+{
+	sector = (sector + 1) % nsectores;
+	secuencia++;
+	esp_err_t ret = esp_partition_erase_range(particion, sector * REGISTRO_SECTOR, REGISTRO_SECTOR);
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+	registro_cabecera_t cab = {REGISTRO_MAGICO, secuencia, arranque, 0, esp_timer_get_time()};
+	hueco = CABECERA_HUECOS;
+	return esp_partition_write(particion, sector * REGISTRO_SECTOR, &cab, sizeof(cab));
+}
+
+// Escribe las muestras de una página de RAM, abriendo sector cuando se llena el actual
+static void registro_escribir(const registro_pagina_t *p)
+{
+	size_t i = 0;
+
+	while (i < p->n)
+	{
+		if (hueco >= HUECOS_SECTOR && registro_abrir_sector() != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Error al abrir el sector %u", (unsigned) sector);
+			atomic_fetch_add(&perdidas, p->n - i);
+			hueco = HUECOS_SECTOR;
+			return;
+		}
+		// Cada escritura se queda dentro de una página de la flash (y por tanto del sector)
+		size_t n = p->n - i;
+		size_t hasta_pagina = REGISTRO_POR_PAGINA - hueco % REGISTRO_POR_PAGINA;
+		if (n > hasta_pagina)
+		{
+			n = hasta_pagina;
+		}
+		if (esp_partition_write(particion, sector * REGISTRO_SECTOR + hueco * HUECO, &p->m[i], n * HUECO) != ESP_OK)
+		{
+			atomic_fetch_add(&perdidas, n);
+		}
+		else
+		{
+			escritas += n;
+		}
+		hueco += n;
+		i += n;
+	}
+}
+
+static void registro_tarea(void *arg)
+{
+	registro_pagina_t *p;
+
+	for (;;)
+	{
+		if (xQueueReceive(llenas, &p, portMAX_DELAY) == pdTRUE)
+		{
+			registro_escribir(p);
+			p->n = 0;
+			xQueueSend(libres, &p, portMAX_DELAY);
+		}
+	}
+}
+
+// Número de arranque: contador persistente en NVS
+static uint32_t registro_contar_arranque(void)
+{
+	nvs_handle_t nvs;
+	uint32_t n = 0;
+
+	if (nvs_open("registro", NVS_READWRITE, &nvs) != ESP_OK)
+	{
+		return 0;
+	}
+	nvs_get_u32(nvs, "arranques", &n);
+	n++;
+	nvs_set_u32(nvs, "arranques", n);
+	nvs_commit(nvs);
+	nvs_close(nvs);
+	return n;
+}
+
+static bool registro_leer_cabecera(uint32_t s, registro_cabecera_t *cab)
+{
+	return esp_partition_read(particion, s * REGISTRO_SECTOR, cab, sizeof(*cab)) == ESP_OK &&
+		   cab->magico == REGISTRO_MAGICO;
+}
+
+esp_err_t registro_init(BaseType_t core)
+{
+	particion = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) REGISTRO_SUBTIPO, "registro");
+	if (particion == NULL)
+	{
+		ESP_LOGW(TAG, "No existe la partición del registro (ver partitions.csv)");
+		return ESP_ERR_NOT_FOUND;
+	}
+	nsectores = particion->size / REGISTRO_SECTOR;
+	arranque = registro_contar_arranque();
+
+	// Se continúa tras el sector más reciente; el que estaba a medias queda como está
+	registro_cabecera_t cab;
+	sector = nsectores - 1;
+	secuencia = 0;
+	for (uint32_t s = 0; s < nsectores; s++)
+	{
+		if (registro_leer_cabecera(s, &cab) && cab.secuencia >= secuencia)
+		{
+			secuencia = cab.secuencia;
+			sector = s;
+		}
+	}
+	hueco = HUECOS_SECTOR;
+
+#if MEMORIA_ESTATICA
+	static StaticQueue_t libres_buf, llenas_buf;
+	static uint8_t libres_mem[REGISTRO_PAGINAS * sizeof(registro_pagina_t *)];
+	static uint8_t llenas_mem[REGISTRO_PAGINAS * sizeof(registro_pagina_t *)];
+	libres = xQueueCreateStatic(REGISTRO_PAGINAS, sizeof(registro_pagina_t *), libres_mem, &libres_buf);
+	llenas = xQueueCreateStatic(REGISTRO_PAGINAS, sizeof(registro_pagina_t *), llenas_mem, &llenas_buf);
+#else
+	libres = xQueueCreate(REGISTRO_PAGINAS, sizeof(registro_pagina_t *));
+	llenas = xQueueCreate(REGISTRO_PAGINAS, sizeof(registro_pagina_t *));
+#endif
+	for (int i = 1; i < REGISTRO_PAGINAS; i++)
+	{
+		registro_pagina_t *p = &paginas[i];
+		p->n = 0;
+		xQueueSend(libres, &p, 0);
+	}
+	actual = &paginas[0];
+	actual->n = 0;
+	ultimo_flush = esp_timer_get_time();
+
+	// Prioridad 0, la de las tareas del pipeline: la escritura no es urgente (hay
+	// REGISTRO_PAGINAS de margen) y no debe adelantarse al muestreo ni al voto
+#if MEMORIA_ESTATICA
+	static StaticTask_t tcb;
+	SYSTEM_TASK_STACK(pila, REGISTRO_STACK_SIZE);
+	xTaskCreateStaticPinnedToCore(registro_tarea, "registro", REGISTRO_STACK_SIZE, NULL, 0, pila, &tcb, core);
+#else
+	xTaskCreatePinnedToCore(registro_tarea, "registro", REGISTRO_STACK_SIZE, NULL, 0, NULL, core);
+#endif
+	ESP_LOGI(TAG, "Registro: %u sectores de %u muestras, arranque %u", (unsigned) nsectores,
+			 (unsigned) (HUECOS_SECTOR - CABECERA_HUECOS), (unsigned) arranque);
+	return ESP_OK;
+}
+
+bool registro_activo(void)
+{
+	return actual != NULL;
+}
+
+uint32_t registro_arranque(void)
+{
+	return arranque;
+}
+
+void registro_flush(void)
+{
+	if (actual == NULL)
+	{
+		return;
+	}
+	ultimo_flush = esp_timer_get_time();
+	if (actual->n == 0)
+	{
+		return;
+	}
+	// Si no queda página libre, la tarea va retrasada: se descarta la actual
+	registro_pagina_t *nueva;
+	if (xQueueReceive(libres, &nueva, 0) != pdTRUE)
+	{
+		atomic_fetch_add(&perdidas, actual->n);
+		actual->n = 0;
+		return;
+	}
+	xQueueSend(llenas, &actual, 0);
+	actual = nueva;
+}
+
+void registro_anotar(const mensaje *msg)
+{
+	if (actual == NULL)
+	{
+		return;
+	}
+	registro_muestra_t *m = &actual->m[actual->n++];
+	m->ts_us = msg->ts_us;
+	m->seq = msg->seq;
+	memcpy(m->lsb, msg->lsb, sizeof(m->lsb));
+	memcpy(m->media_cdeg, msg->media_cdeg, sizeof(m->media_cdeg));
+	m->fallos = msg->fallos;
+	m->valido = REGISTRO_VALIDO;
+
+	if (actual->n == REGISTRO_POR_PAGINA ||
+		esp_timer_get_time() - ultimo_flush >= REGISTRO_FLUSH_MS * 1000LL)
+	{
+		registro_flush();
+	}
+}
+
+size_t registro_leer(uint32_t arr, uint64_t desde_us, uint64_t hasta_us, registro_cb_t cb, void *ctx)
+{
+	registro_muestra_t buf[REGISTRO_POR_PAGINA];
+	registro_cabecera_t cab;
+	size_t entregadas = 0;
+
+	if (particion == NULL)
+	{
+		return 0;
+	}
+
+	// El sector más antiguo es el de menor secuencia: se empieza por él y se
+	// sigue en orden circular
+	uint32_t primero = 0;
+	uint32_t menor = UINT32_MAX;
+	for (uint32_t s = 0; s < nsectores; s++)
+	{
+		if (registro_leer_cabecera(s, &cab) && cab.secuencia < menor)
+		{
+			menor = cab.secuencia;
+			primero = s;
+		}
+	}
+
+	for (uint32_t k = 0; k < nsectores; k++)
+	{
+		uint32_t s = (primero + k) % nsectores;
+		if (!registro_leer_cabecera(s, &cab) || (arr != REGISTRO_TODOS && cab.arranque != arr))
+		{
+			continue;
+		}
+		for (uint32_t h = CABECERA_HUECOS; h < HUECOS_SECTOR; h += REGISTRO_POR_PAGINA)
+		{
+			size_t n = HUECOS_SECTOR - h;
+			if (n > REGISTRO_POR_PAGINA)
+			{
+				n = REGISTRO_POR_PAGINA;
+			}
+			if (esp_partition_read(particion, s * REGISTRO_SECTOR + h * HUECO, buf, n * HUECO) != ESP_OK)
+			{
+				break;
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				if (buf[i].valido != REGISTRO_VALIDO)
+				{
+					// Resto del sector sin escribir
+					h = HUECOS_SECTOR;
+					break;
+				}
+				uint64_t t = registro_t64(cab.t0_us, buf[i].ts_us);
+				if (t < desde_us || t > hasta_us)
+				{
+					continue;
+				}
+				entregadas++;
+				if (!cb(&buf[i], cab.arranque, t, ctx))
+				{
+					return entregadas;
+				}
+			}
+		}
+	}
+	return entregadas;
+}
+
+uint32_t registro_perdidas(void)
+{
+	return atomic_load(&perdidas);
+}
+
+uint32_t registro_escritas(void)
+{
+	return escritas;
+}
@@ -0,0 +1,136 @@
+// Cola SPSC sin cerrojos (ver spsc.h)
+#include <string.h>
+#include <assert.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "spsc.h"
+
+void spsc_init(spsc_t *q, uint8_t *storage, uint32_t nslots, uint32_t slot_size)
+{
+	assert(nslots && (nslots & (nslots - 1)) == 0);
+	memset(q, 0, sizeof(*q));
+	q->storage = storage;
+	q->nslots = nslots;
+	q->slot_size = slot_size;
+	q->stride = SPSC_STRIDE(slot_size);
+}
+
+static inline uint32_t *spsc_slot(spsc_t *q, uint32_t idx)
+{
+	return (uint32_t *) &q->storage[(idx & (q->nslots - 1)) * q->stride];
+}
+
+// Espera a que el otro lado avance. Protocolo: se publica la intención de
+// dormir (wait = 1) y se vuelve a comprobar la condición antes de bloquearse;
+// el otro lado actualiza su índice y después consulta wait. Con orden
+// secuencialmente consistente en ambos pasos no se puede perder un despertar.
+// Lo mismo vale para el cierre (spsc_cerrar), que se publica antes de consultar wait.
+// Devuelve pdFALSE si vence el timeout o la cola está cerrada.
+static BaseType_t spsc_wait(spsc_t *q, _Atomic uint32_t *wait, TaskHandle_t *task, _Atomic uint32_t *idx,
+							uint32_t blocked_value, TickType_t *remaining)
+{
+	if (*remaining == 0)
+	{
+		return pdFALSE;
+	}
+	*task = xTaskGetCurrentTaskHandle();
+	atomic_store(wait, 1);
+	if (atomic_load(&q->cerrada))
+	{
+		atomic_store(wait, 0);
+		return pdFALSE;
+	}
+	if (atomic_load(idx) != blocked_value)
+	{
+		atomic_store(wait, 0);
+		return pdTRUE;
+	}
+	TickType_t start = xTaskGetTickCount();
+	uint32_t woken = ulTaskNotifyTakeIndexed(SPSC_NOTIFY_INDEX, pdTRUE, *remaining);
+	atomic_store(wait, 0);
+	// Sin notificación ha vencido el plazo; con ella, puede que se haya cerrado la cola
+	if (woken == 0 || atomic_load(&q->cerrada))
+	{
+		*remaining = 0;
+		return pdFALSE;
+	}
+	if (*remaining != portMAX_DELAY)
+	{
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		*remaining = (elapsed >= *remaining) ? 0 : *remaining - elapsed;
+	}
+	return pdTRUE;
+}
+
+static inline void spsc_wake(_Atomic uint32_t *wait, TaskHandle_t task)
+{
+	if (atomic_exchange(wait, 0))
+	{
+		xTaskNotifyGiveIndexed(task, SPSC_NOTIFY_INDEX);
+	}
+}
+
+void *spsc_acquire(spsc_t *q, size_t len, TickType_t timeout)
+{
+	if (len > q->slot_size)
+	{
+		return NULL;
+	}
+	uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	// Cola llena: el consumidor aún no ha devuelto el hueco de hace nslots vueltas
+	while (head - atomic_load_explicit(&q->tail, memory_order_acquire) >= q->nslots)
+	{
+		if (spsc_wait(q, &q->prod_wait, &q->prod_task, &q->tail, head - q->nslots, &timeout) != pdTRUE)
+		{
+			return NULL;
+		}
+	}
+	uint32_t *slot = spsc_slot(q, head);
+	slot[0] = len;
+	return &slot[1];
+}
+
+void spsc_commit(spsc_t *q, void *ptr)
+{
+	// El hueco publicado es siempre el siguiente: ptr solo se recibe por simetría con el ringbuf
+	(void) ptr;
+	atomic_store(&q->head, atomic_load_explicit(&q->head, memory_order_relaxed) + 1);
+	spsc_wake(&q->cons_wait, q->cons_task);
+}
+
+void *spsc_receive(spsc_t *q, size_t *len, TickType_t timeout)
+{
+	uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	// Cola vacía
+	while (atomic_load_explicit(&q->head, memory_order_acquire) == tail)
+	{
+		if (spsc_wait(q, &q->cons_wait, &q->cons_task, &q->head, tail, &timeout) != pdTRUE)
+		{
+			return NULL;
+		}
+	}
+	uint32_t *slot = spsc_slot(q, tail);
+	*len = slot[0];
+	return &slot[1];
+}
+
+void spsc_release(spsc_t *q, void *ptr)
+{
+	(void) ptr;
+	atomic_store(&q->tail, atomic_load_explicit(&q->tail, memory_order_relaxed) + 1);
+	spsc_wake(&q->prod_wait, q->prod_task);
+}
+
+void spsc_cerrar(spsc_t *q)
+{
+	atomic_store(&q->cerrada, 1);
+	spsc_wake(&q->prod_wait, q->prod_task);
+	spsc_wake(&q->cons_wait, q->cons_task);
+}
+
+uint32_t spsc_count(spsc_t *q)
+{
+	return atomic_load(&q->head) - atomic_load(&q->tail);
+}
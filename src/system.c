@@ -12,91 +12,324 @@
 ******************************************************************************/
 
 #include <string.h>
+#include <assert.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <freertos/event_groups.h>
 
-#include <esp_event.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "system.h"
 
 static const char *TAG = "system";
 
 
-static void __on_sys_state_change(void* handler_arg, esp_event_base_t base, int32_t id, void* ptr)
-{
-	system_t *system = (system_t *) handler_arg;
-	xSemaphoreTake(system->sys_st_mutex, 0);
-	system->sys_state = id;
-	xSemaphoreGive(system->sys_new_state);
-	xSemaphoreGive(system->sys_st_mutex);
-}
-
 // system create
 void system_create(system_t* sys, const char* id)
 {
-	char evt_loop_task_name[32] = "";
-	
-	//mutex(s) 
-	sys->sys_st_mutex = xSemaphoreCreateBinary();
-	sys->sys_new_state = xSemaphoreCreateBinary();
-	sys->sys_nstates = 0;
-	
+	memset(sys, 0, sizeof(*sys));
+
 	// name
-	// strlen(id) < 16
-	strcpy(sys->sys_id, id);
-	
-	// system event loop
-	strcat(evt_loop_task_name, id);
-	strcat(evt_loop_task_name, "__evt_loop_task");
-	sys->sys_evt_loop_args.queue_size = 5;
-	sys->sys_evt_loop_args.task_name = evt_loop_task_name; 
-	sys->sys_evt_loop_args.task_priority = uxTaskPriorityGet(NULL);
-	sys->sys_evt_loop_args.task_stack_size = 3072;
-	sys->sys_evt_loop_args.task_core_id = tskNO_AFFINITY;
-	esp_event_loop_create(&(sys->sys_evt_loop_args), &(sys->sys_evt_loop));
+	strncpy(sys->sys_id, id, sizeof(sys->sys_id) - 1);
+
+	// one slot per state: with the pending bitmap a state is never queued twice,
+	// so the queue cannot fill up
+#if SYSTEM_STATIC
+	sys->sys_queue = xQueueCreateStatic(SYSTEM_MAX_STATES, sizeof(uint8_t), sys->sys_queue_storage, &sys->sys_queue_buf);
+#else
+	sys->sys_queue = xQueueCreate(SYSTEM_MAX_STATES, sizeof(uint8_t));
+#endif
+	configASSERT(sys->sys_queue);
+	sys->sys_state = SYSTEM_NO_STATE;
+
+	// task lifecycle
+#if SYSTEM_STATIC
+	sys->sys_tasks = xEventGroupCreateStatic(&sys->sys_tasks_buf);
+#else
+	sys->sys_tasks = xEventGroupCreate();
+#endif
+	configASSERT(sys->sys_tasks);
+
+	// startup barrier
+#if SYSTEM_STATIC
+	sys->sys_ready = xEventGroupCreateStatic(&sys->sys_ready_buf);
+#else
+	sys->sys_ready = xEventGroupCreate();
+#endif
+	configASSERT(sys->sys_ready);
 }
 
 // system add state
 
 void system_register_state(system_t *sys, uint8_t st)
 {
-	esp_event_handler_register_with(sys->sys_evt_loop, (esp_event_base_t) sys->sys_id, st, __on_sys_state_change, sys);
-	sys->sys_nstates+=1;
+	system_register_state_handlers(sys, st, NULL, NULL);
+}
+
+void system_register_state_handlers(system_t *sys, uint8_t st, system_handler_t on_entry, system_handler_t on_exit)
+{
+	assert(st < SYSTEM_MAX_STATES);
+	if (!sys->sys_states[st].registered)
+	{
+		sys->sys_nstates+=1;
+	}
+	sys->sys_states[st].registered = true;
+	sys->sys_states[st].on_entry = on_entry;
+	sys->sys_states[st].on_exit = on_exit;
+}
+
+// system add transition
+
+static system_transition_t *__add_transition(system_t *sys, uint8_t from, uint8_t to, system_guard_t guard, system_handler_t action)
+{
+	if (sys->sys_ntransitions >= SYSTEM_MAX_TRANSITIONS)
+	{
+		return NULL;
+	}
+	system_transition_t *tr = &sys->sys_transitions[sys->sys_ntransitions++];
+	memset(tr, 0, sizeof(*tr));
+	tr->from = from;
+	tr->to = to;
+	tr->guard = guard;
+	tr->action = action;
+	return tr;
+}
+
+void system_register_transition(system_t *sys, uint8_t from, uint8_t to, system_guard_t guard, system_handler_t action)
+{
+	if (__add_transition(sys, from, to, guard, action) == NULL)
+	{
+		ESP_LOGE(TAG, "Transition table full");
+	}
+}
+
+static system_transition_t *__find_transition(system_t *sys, uint8_t from, uint8_t to)
+{
+	for (int i = 0; i < sys->sys_ntransitions; i++)
+	{
+		system_transition_t *tr = &sys->sys_transitions[i];
+		if ((tr->from == from || tr->from == SYSTEM_ANY_STATE) && (tr->to == to || tr->to == SYSTEM_ANY_STATE))
+		{
+			return tr;
+		}
+	}
+	return NULL;
 }
 
 // system set default state
 
 void system_set_default_state(system_t *sys, uint8_t default_st)
 {
-	sys->sys_state = default_st;
-	if (!uxSemaphoreGetCount(sys->sys_new_state))
-		xSemaphoreGive(sys->sys_new_state);
+	system_post_state(sys, default_st, 0);
+}
+
+// system post a state request
+
+BaseType_t system_post_state(system_t *sys, uint8_t st, TickType_t timeout)
+{
+	assert(st < SYSTEM_MAX_STATES);
+	uint32_t bit = 1u << st;
+
+	// already queued: the pending request will be served
+	if (atomic_fetch_or(&sys->sys_pending, bit) & bit)
+	{
+		atomic_fetch_add(&sys->sys_coalesced, 1);
+		return pdTRUE;
+	}
+	sys->sys_pending_us[st] = esp_timer_get_time();
+	if (xQueueSend(sys->sys_queue, &st, timeout) != pdTRUE)
+	{
+		atomic_fetch_and(&sys->sys_pending, ~bit);
+		atomic_fetch_add(&sys->sys_dropped, 1);
+		return pdFALSE;
+	}
+	atomic_fetch_add(&sys->sys_posted, 1);
+	return pdTRUE;
+}
+
+// system request filter
+
+void system_hysteresis_init(system_hysteresis_t *h, uint16_t threshold)
+{
+	h->threshold = threshold ? threshold : 1;
+	h->suppressed = 0;
+	system_hysteresis_clear(h);
+}
+
+void system_hysteresis_clear(system_hysteresis_t *h)
+{
+	h->last_st = SYSTEM_NO_STATE;
+	h->streak = 0;
+	h->posted = false;
+}
+
+BaseType_t system_request_state(system_t *sys, system_hysteresis_t *h, uint8_t st)
+{
+	if (st != h->last_st)
+	{
+		h->last_st = st;
+		h->streak = 0;
+		h->posted = false;
+	}
+	if (h->streak < UINT16_MAX)
+	{
+		h->streak++;
+	}
+
+	if (h->posted || h->streak < h->threshold || sys->sys_state == st)
+	{
+		h->suppressed++;
+		atomic_fetch_add(&sys->sys_suppressed, 1);
+		return pdFALSE;
+	}
+	h->posted = true;
+	return system_post_state(sys, st, 0);
+}
+
+// system wait and apply the next accepted state request
+
+uint8_t system_wait_state(system_t *sys)
+{
+	uint8_t to;
+
+	while (1)
+	{
+		if (xQueueReceive(sys->sys_queue, &to, portMAX_DELAY) != pdTRUE)
+		{
+			continue;
+		}
+		int64_t posted_us = sys->sys_pending_us[to];
+		// from here on a new request for `to` is queued again
+		atomic_fetch_and(&sys->sys_pending, ~(1u << to));
+
+		uint8_t from = sys->sys_state;
+		system_transition_t *tr = __find_transition(sys, from, to);
+		if (tr == NULL && from == to)
+		{
+			atomic_fetch_add(&sys->sys_coalesced, 1);
+			continue;
+		}
+		if (tr != NULL && tr->guard != NULL && !tr->guard(sys, from, to))
+		{
+			tr->rejected++;
+			continue;
+		}
+		// unregistered transitions get their own entry, only for the counters
+		if (tr == NULL)
+		{
+			tr = __add_transition(sys, from, to, NULL, NULL);
+		}
+		// with the table full the transition is still taken, only its counters are lost
+		if (tr == NULL && sys->sys_untracked++ == 0)
+		{
+			ESP_LOGW(TAG, "%s: transition table full, %d -> %d and later new transitions are not counted",
+					 sys->sys_id, from == SYSTEM_NO_STATE ? -1 : from, to);
+		}
+
+		if (from != SYSTEM_NO_STATE && sys->sys_states[from].on_exit != NULL)
+		{
+			sys->sys_states[from].on_exit(sys, from, to);
+		}
+		if (tr != NULL && tr->action != NULL)
+		{
+			tr->action(sys, from, to);
+		}
+		sys->sys_state = to;
+		if (sys->sys_states[to].on_entry != NULL)
+		{
+			sys->sys_states[to].on_entry(sys, from, to);
+		}
+
+		if (tr != NULL)
+		{
+			uint32_t latency_us = esp_timer_get_time() - posted_us;
+			tr->count++;
+			tr->latency_sum_us += latency_us;
+			if (latency_us > tr->latency_max_us)
+			{
+				tr->latency_max_us = latency_us;
+			}
+		}
+		return to;
+	}
+}
+
+// system statistics
+
+void system_print_stats(system_t *sys)
+{
+	ESP_LOGI(TAG, "%s: requests %u, coalesced %u, dropped %u, suppressed %u", sys->sys_id,
+			 (unsigned) atomic_load(&sys->sys_posted), (unsigned) atomic_load(&sys->sys_coalesced),
+			 (unsigned) atomic_load(&sys->sys_dropped), (unsigned) atomic_load(&sys->sys_suppressed));
+	if (sys->sys_untracked)
+	{
+		ESP_LOGW(TAG, "  %u transitions not counted (table full)", (unsigned) sys->sys_untracked);
+	}
+	for (int i = 0; i < sys->sys_ntransitions; i++)
+	{
+		system_transition_t *tr = &sys->sys_transitions[i];
+		if (tr->count == 0 && tr->rejected == 0)
+		{
+			continue;
+		}
+		ESP_LOGI(TAG, "  %d -> %d: %u taken, %u rejected, latency avg %u us max %u us",
+				 tr->from == SYSTEM_ANY_STATE ? -1 : tr->from, tr->to == SYSTEM_ANY_STATE ? -1 : tr->to,
+				 (unsigned) tr->count, (unsigned) tr->rejected,
+				 (unsigned) (tr->count ? tr->latency_sum_us / tr->count : 0), (unsigned) tr->latency_max_us);
+	}
 }
 
 // (common private) system task start
 
-static void __system_task_start(system_t *sys, system_task_t *task, void* args)
+static void __system_task_start(system_t *sys, system_task_t *task, const char *name, configSTACK_DEPTH_TYPE stack_depth, void* args)
 {
 	// system
 	task->system = sys; 
 	
-	// mutex to stop the task
-	
-	task->sys_task_stop = xSemaphoreCreateBinary();
-	xSemaphoreGive(task->sys_task_stop);
+	// finish bit in the system event group
+	EventBits_t free_bits = ~sys->sys_task_bits & ((1u << SYSTEM_MAX_TASKS) - 1);
+	configASSERT(free_bits);
+	task->sys_task_bit = free_bits & -free_bits;
+	sys->sys_task_bits |= task->sys_task_bit;
+	xEventGroupClearBits(sys->sys_tasks, task->sys_task_bit);
+	xEventGroupClearBits(sys->sys_ready, task->sys_task_bit);
+	atomic_store(&task->sys_task_state, SYSTEM_TASK_RUNNING);
 
 	// args
 	task->sys_task_args = args;
+	task->sys_task_name = name;
+
+	// instrumentation
+	task->sys_task_stack = stack_depth;
+	task->sys_task_busy_start = 0;
+	task->sys_task_loops = 0;
+	task->sys_task_busy_max_us = 0;
+	task->sys_task_busy_sum_us = 0;
+	memset(task->sys_task_busy_hist, 0, sizeof(task->sys_task_busy_hist));
+	task->sys_task_wake = NULL;
+	task->sys_task_wake_ctx = NULL;
+	task->sys_task_queue = NULL;
+	task->sys_task_queue_ctx = NULL;
+	task->sys_task_queue_max = 0;
+	task->sys_task_prev_runtime = 0;
+	task->sys_task_prev_report_us = 0;
+	sys->sys_task_list[__builtin_ctz(task->sys_task_bit)] = task;
+
+	// timing
+	task->sys_task_start_us = 0;
+	task->sys_task_ready_us = 0;
+	task->sys_task_created_us = esp_timer_get_time();
 }
 
 // system task start
 void system_task_start(system_t *sys, system_task_t *task, TaskFunction_t function, const char * const name, configSTACK_DEPTH_TYPE stack_depth, void* args, UBaseType_t priority)
 {
 	
-	__system_task_start(sys, task, args);
+	__system_task_start(sys, task, name, stack_depth, args);
 	
 	// creation 
 	xTaskCreate( function, name, stack_depth, task, priority, &(task->sys_task_handler));
@@ -109,27 +342,391 @@ void system_task_start(system_t *sys, system_task_t *task, TaskFunction_t functi
 
 void system_task_start_in_core(system_t *sys, system_task_t *task, TaskFunction_t function, const char * const name, configSTACK_DEPTH_TYPE stack_depth, void* args, UBaseType_t priority, BaseType_t coreid)
 {
-	__system_task_start(sys, task, args);
+	__system_task_start(sys, task, name, stack_depth, args);
 	
 	// creation 
 	xTaskCreatePinnedToCore( function, name, stack_depth, task, priority, &task->sys_task_handler, coreid);
 	configASSERT(task->sys_task_handler );
 }
 
+#if SYSTEM_STATIC
+// system task start in a specific core, without heap
+
+void system_task_start_static_in_core(system_t *sys, system_task_t *task, TaskFunction_t function, const char * const name, StackType_t *stack, configSTACK_DEPTH_TYPE stack_depth, void* args, UBaseType_t priority, BaseType_t coreid)
+{
+	__system_task_start(sys, task, name, stack_depth, args);
+
+	// creation
+	task->sys_task_handler = xTaskCreateStaticPinnedToCore( function, name, stack_depth, task, priority, stack, &task->sys_task_tcb, coreid);
+	configASSERT(task->sys_task_handler);
+}
+#endif
+
+// task side of the lifecycle
+
+void system_task_begin(system_task_t *task)
+{
+	task->sys_task_start_us = esp_timer_get_time() - task->sys_task_created_us;
+}
+
+void system_task_ready(system_task_t *task)
+{
+	task->sys_task_ready_us = esp_timer_get_time() - task->sys_task_created_us;
+	xEventGroupSetBits(task->system->sys_ready, task->sys_task_bit);
+	// bounded waits, so that a stop request before the release is seen: TASK_LOOP() then ends at once
+	while (!(xEventGroupWaitBits(task->system->sys_ready, SYSTEM_READY_GO, pdFALSE, pdTRUE,
+								 pdMS_TO_TICKS(SYSTEM_STOP_POLL_MS)) & SYSTEM_READY_GO))
+	{
+		if (system_task_stopping(task))
+		{
+			return;
+		}
+	}
+}
+
+void system_task_end(system_task_t *task)
+{
+	// the stopper may release the structure as soon as the bit is set
+	EventGroupHandle_t group = task->system->sys_tasks;
+	EventBits_t bit = task->sys_task_bit;
+	task->sys_task_end_us = esp_timer_get_time();
+
+	// if the stopper has already given up on the task it is about to delete it
+	int st = atomic_load(&task->sys_task_state);
+	while (st != SYSTEM_TASK_KILLED)
+	{
+		// the stopper is running the wake hook, which may still use the task handle
+		if (st == SYSTEM_TASK_WAKING)
+		{
+			vTaskDelay(1);
+			st = atomic_load(&task->sys_task_state);
+			continue;
+		}
+		if (atomic_compare_exchange_weak(&task->sys_task_state, &st, SYSTEM_TASK_EXITED))
+		{
+			xEventGroupSetBits(group, bit);
+			vTaskDelete(NULL);
+		}
+	}
+	while (1) vTaskDelay(portMAX_DELAY);
+}
+
 // system task stop 
 
 void system_task_stop(system_t *sys, system_task_t *task, uint16_t timeout_ms)
 {
+	system_task_t *const tasks[] = {task};
+	system_task_stop_all(sys, tasks, 1, timeout_ms);
+}
+
+// system stop several tasks with a common deadline
+
+int system_task_stop_all(system_t *sys, system_task_t *const tasks[], size_t n, uint32_t timeout_ms)
+{
+	int64_t t0 = esp_timer_get_time();
+	int64_t deadline = t0 + timeout_ms * 1000LL;
+	EventBits_t bits = 0;
+	int killed = 0;
+
+	// flag every task first, so that all of them wind down at the same time
+	for (size_t i = 0; i < n; i++)
+	{
+		if (!system_task_alive(sys, tasks[i]))
+		{
+			continue;
+		}
+		bits |= tasks[i]->sys_task_bit;
+		// a task that has already left its loop on its own stays EXITED
+		int expected = SYSTEM_TASK_RUNNING;
+		atomic_compare_exchange_strong(&tasks[i]->sys_task_state, &expected, SYSTEM_TASK_STOPPING);
+	}
+
+	// wake the blocked ones through their own primitive; a task may check the flag just before
+	// blocking, so this is repeated every few ticks until all of them have finished or the
+	// deadline expires. WAKING keeps the task from deleting itself while the hook runs.
+	EventBits_t done = 0;
+	while (1)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			system_task_t *task = tasks[i];
+			if (!system_task_alive(sys, task) || (done & task->sys_task_bit) || task->sys_task_wake == NULL)
+			{
+				continue;
+			}
+			int expected = SYSTEM_TASK_STOPPING;
+			if (atomic_compare_exchange_strong(&task->sys_task_state, &expected, SYSTEM_TASK_WAKING))
+			{
+				task->sys_task_wake(task->sys_task_wake_ctx);
+				atomic_store(&task->sys_task_state, SYSTEM_TASK_STOPPING);
+			}
+		}
+		int64_t remaining_us = deadline - esp_timer_get_time();
+		if (remaining_us <= 0)
+		{
+			break;
+		}
+		TickType_t wait = pdMS_TO_TICKS(remaining_us / 1000);
+		if (wait > pdMS_TO_TICKS(SYSTEM_STOP_POLL_MS))
+		{
+			wait = pdMS_TO_TICKS(SYSTEM_STOP_POLL_MS);
+		}
+		done = xEventGroupWaitBits(sys->sys_tasks, bits, pdFALSE, pdTRUE, wait ? wait : 1) & bits;
+		if (done == bits)
+		{
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		system_task_t *task = tasks[i];
+		if (!system_task_alive(sys, task))
+		{
+			continue;
+		}
+		int expected = SYSTEM_TASK_STOPPING;
+		if (atomic_compare_exchange_strong(&task->sys_task_state, &expected, SYSTEM_TASK_KILLED))
+		{
+			// did not reach TASK_END() in time
+			ESP_LOGW(TAG, "Task stop timeout");
+			vTaskDelete(task->sys_task_handler);
+			task->sys_task_stop_us = esp_timer_get_time() - t0;
+			killed++;
+		}
+		else
+		{
+			task->sys_task_stop_us = (task->sys_task_end_us > t0) ? task->sys_task_end_us - t0 : 0;
+		}
+		ESP_LOGI(TAG, "Task %s: started in %u us, stopped in %u us", task->sys_task_name,
+				 (unsigned) task->sys_task_start_us, (unsigned) task->sys_task_stop_us);
+
+		sys->sys_task_bits &= ~task->sys_task_bit;
+		sys->sys_task_list[__builtin_ctz(task->sys_task_bit)] = NULL;
+		task->sys_task_handler = NULL;
+		task->sys_task_args = NULL;
+		task->sys_task_name = NULL;
+		task->system = NULL;
+	}
+	ESP_LOGI(TAG, "%u task(s) stopped in %u us", (unsigned) n, (unsigned) (esp_timer_get_time() - t0));
+	return killed;
+}
+
+// task instrumentation
+
+void system_task_busy_end(system_task_t *task)
+{
+	uint32_t busy_us = esp_timer_get_time() - task->sys_task_busy_start;
+	task->sys_task_busy_start = 0;
+	task->sys_task_loops++;
+	task->sys_task_busy_sum_us += busy_us;
+	if (busy_us > task->sys_task_busy_max_us)
+	{
+		task->sys_task_busy_max_us = busy_us;
+	}
+	int b = (busy_us == 0) ? 0 : 31 - __builtin_clz(busy_us);
+	if (b >= SYSTEM_LOOP_BUCKETS)
+	{
+		b = SYSTEM_LOOP_BUCKETS - 1;
+	}
+	task->sys_task_busy_hist[b]++;
+}
+
+void system_task_on_stop(system_task_t *task, system_task_wake_t wake, void *ctx)
+{
+	// the context first: the stopper reads the hook without locking
+	task->sys_task_wake_ctx = ctx;
+	atomic_signal_fence(memory_order_seq_cst);
+	task->sys_task_wake = wake;
+}
+
+void system_task_set_queue(system_task_t *task, system_queue_level_t level, void *ctx)
+{
+	task->sys_task_queue_ctx = ctx;
+	task->sys_task_queue = level;
+}
 
-	// stop task perception
-	assert(xSemaphoreTake(task->sys_task_stop, pdMS_TO_TICKS(10)) == pdTRUE);
-	if (xSemaphoreTake(task->sys_task_stop, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+// upper bound (us) of the histogram bucket holding the given fraction of the iterations
+static uint32_t __busy_percentile(const system_task_t *task, uint32_t n, uint32_t permille)
+{
+	uint32_t target = ((uint64_t) n * permille + 999) / 1000;
+	uint32_t acc = 0;
+	for (int b = 0; b < SYSTEM_LOOP_BUCKETS; b++)
+	{
+		acc += task->sys_task_busy_hist[b];
+		if (acc >= target)
+		{
+			return 2u << b;
+		}
+	}
+	return task->sys_task_busy_max_us;
+}
+
+void system_report(system_t *sys)
+{
+	int64_t now = esp_timer_get_time();
+
+	ESP_LOGI(TAG, "%s: report", sys->sys_id);
+	for (int i = 0; i < SYSTEM_MAX_TASKS; i++)
+	{
+		system_task_t *task = sys->sys_task_list[i];
+		if (task == NULL || task->sys_task_handler == NULL ||
+			atomic_load(&task->sys_task_state) != SYSTEM_TASK_RUNNING)
+		{
+			continue;
+		}
+
+		// CPU time since the previous report
+		float cpu = -1.0f;
+#if configGENERATE_RUN_TIME_STATS
+		uint32_t runtime = ulTaskGetRunTimeCounter(task->sys_task_handler);
+		int64_t since = task->sys_task_prev_report_us ? task->sys_task_prev_report_us : task->sys_task_created_us;
+		if (now > since)
+		{
+			cpu = 100.0f * (uint32_t) (runtime - task->sys_task_prev_runtime) / (now - since);
+		}
+		task->sys_task_prev_runtime = runtime;
+#endif
+		task->sys_task_prev_report_us = now;
+
+		// stack: in ESP-IDF the high water mark is in bytes
+		unsigned stack_free = uxTaskGetStackHighWaterMark(task->sys_task_handler);
+
+		// input queue
+		int queue_pct = -1, queue_max_pct = -1;
+		if (task->sys_task_queue != NULL)
+		{
+			size_t capacity = 0;
+			size_t used = task->sys_task_queue(task->sys_task_queue_ctx, &capacity);
+			if (used > task->sys_task_queue_max)
+			{
+				task->sys_task_queue_max = used;
+			}
+			if (capacity)
+			{
+				queue_pct = 100 * used / capacity;
+				queue_max_pct = 100 * task->sys_task_queue_max / capacity;
+			}
+		}
+
+		uint32_t n = task->sys_task_loops;
+		ESP_LOGI(TAG, "  %-14s cpu %5.1f %%, stack free %u/%u B, queue %d %% (max %d %%)",
+				 task->sys_task_name, cpu, stack_free, (unsigned) task->sys_task_stack, queue_pct, queue_max_pct);
+		if (n > 0)
+		{
+			ESP_LOGI(TAG, "  %-14s loops %u, busy avg %u us, max %u us, p50 < %u us, p99 < %u us", "",
+					 (unsigned) n, (unsigned) (task->sys_task_busy_sum_us / n), (unsigned) task->sys_task_busy_max_us,
+					 (unsigned) __busy_percentile(task, n, 500), (unsigned) __busy_percentile(task, n, 990));
+		}
+	}
+
+#if configGENERATE_RUN_TIME_STATS
+	// load per core, from the idle tasks
+	static uint32_t prev_idle[portNUM_PROCESSORS];
+	static int64_t prev_us = 0;
+	for (int core = 0; core < portNUM_PROCESSORS; core++)
+	{
+		uint32_t idle = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+		if (prev_us != 0 && now > prev_us)
+		{
+			ESP_LOGI(TAG, "  core %d load %.1f %%", core, 100.0f - 100.0f * (uint32_t) (idle - prev_idle[core]) / (now - prev_us));
+		}
+		prev_idle[core] = idle;
+	}
+	prev_us = now;
+#endif
+}
+
+// startup barrier
+
+bool system_wait_ready(system_t *sys, system_task_t *const tasks[], size_t n, uint32_t timeout_ms)
+{
+	EventBits_t bits = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		bits |= tasks[i]->sys_task_bit;
+	}
+	EventBits_t ready = xEventGroupWaitBits(sys->sys_ready, bits, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms)) & bits;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (ready & tasks[i]->sys_task_bit)
+		{
+			ESP_LOGI(TAG, "%s ready in %u us", tasks[i]->sys_task_name, (unsigned) tasks[i]->sys_task_ready_us);
+		}
+		else
+		{
+			ESP_LOGW(TAG, "%s not ready after %u ms", tasks[i]->sys_task_name, (unsigned) timeout_ms);
+		}
+	}
+	return ready == bits;
+}
+
+void system_release(system_t *sys)
+{
+	xEventGroupSetBits(sys->sys_ready, SYSTEM_READY_GO);
+}
+
+// periodic reporter
+
+typedef struct
+{
+	system_t *sys;
+	uint32_t period_ms;
+}__reporter_args_t;
+
+// held by the reporter while it reads the task list; system_reporter_stop takes it to wait
+// for a report in progress
+static SemaphoreHandle_t __reporter_lock = NULL;
+static atomic_bool __reporter_stop = false;
+
+static void __reporter_task(void *arg)
+{
+	__reporter_args_t *args = (__reporter_args_t *) arg;
+	TickType_t last = xTaskGetTickCount();
+	while (1)
+	{
+		vTaskDelayUntil(&last, pdMS_TO_TICKS(args->period_ms));
+		xSemaphoreTake(__reporter_lock, portMAX_DELAY);
+		if (atomic_load(&__reporter_stop))
+		{
+			xSemaphoreGive(__reporter_lock);
+			break;
+		}
+		system_report(args->sys);
+		xSemaphoreGive(__reporter_lock);
+	}
+	vTaskDelete(NULL);
+}
+
+void system_reporter_start(system_t *sys, uint32_t period_ms, BaseType_t coreid)
+{
+	static __reporter_args_t args;
+	args.sys = sys;
+	args.period_ms = period_ms;
+	atomic_store(&__reporter_stop, false);
+#if SYSTEM_STATIC
+	static StaticSemaphore_t lock_buf;
+	__reporter_lock = xSemaphoreCreateMutexStatic(&lock_buf);
+#else
+	__reporter_lock = xSemaphoreCreateMutex();
+#endif
+	configASSERT(__reporter_lock);
+#if SYSTEM_STATIC
+	static StaticTask_t tcb;
+	SYSTEM_TASK_STACK(stack, SYSTEM_REPORTER_STACK_SIZE);
+	xTaskCreateStaticPinnedToCore(__reporter_task, "sys_report", SYSTEM_REPORTER_STACK_SIZE, &args, 1, stack, &tcb, coreid);
+#else
+	xTaskCreatePinnedToCore(__reporter_task, "sys_report", SYSTEM_REPORTER_STACK_SIZE, &args, 1, NULL, coreid);
+#endif
+}
+
+void system_reporter_stop(void)
+{
+	if (__reporter_lock == NULL)
 	{
-		ESP_LOGW(TAG, "Task stop timeout");	
+		return;
 	}
-	vTaskDelete(task->sys_task_handler);
-	task->sys_task_handler = NULL;
-	vSemaphoreDelete(task->sys_task_stop);
-	task->sys_task_args = NULL;
-	task-> system = NULL; 
+	xSemaphoreTake(__reporter_lock, portMAX_DELAY);
+	atomic_store(&__reporter_stop, true);
+	xSemaphoreGive(__reporter_lock);
 }
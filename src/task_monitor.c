@@ -14,6 +14,8 @@
 // libc
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include <sys/time.h>
 
 // freerqtos
@@ -29,9 +31,87 @@
 // propias
 #include "config.h"
 #include "term.h"
+#include "traza.h"
+#include "telemetria.h"
+#include "registro.h"
+#include "calibracion.h"
 
 static const char *TAG = "STF_P1:task_monitor";
 
+// Estadísticas de una magnitud en la ventana actual (método de Welford: media y
+// varianza en una sola pasada, sin acumular sumas de cuadrados que pierden precisión)
+typedef struct
+{
+	uint32_t n;
+	int16_t min;
+	int16_t max;
+	float media;
+	float m2;    // suma de cuadrados de las desviaciones respecto a la media
+}estadistica_t;
+
+// Magnitudes agregadas: los termistores y la media votada de cada grupo, en centésimas de grado
+#define MON_NUM (THERM_NUM + GRUPOS)
+static estadistica_t ventana[MON_NUM];
+static uint32_t ventana_fallos;
+
+static void estadistica_reset(estadistica_t* e)
+{
+	e->n = 0;
+	e->min = INT16_MAX;
+	e->max = INT16_MIN;
+	e->media = 0.0f;
+	e->m2 = 0.0f;
+}
+
+static inline void estadistica_add(estadistica_t* e, int16_t x)
+{
+	e->n++;
+	if (x < e->min) e->min = x;
+	if (x > e->max) e->max = x;
+	float d = x - e->media;
+	e->media += d / e->n;
+	e->m2 += d * (x - e->media);
+}
+
+// Una línea por ventana, en grados
+static void ventana_volcar(void)
+{
+	char linea[MON_NUM * 48];
+	char nombre[8];
+	int len = 0;
+
+	if (ventana[0].n == 0)
+	{
+		return;
+	}
+	for (int c = 0; c < MON_NUM && len < (int) sizeof(linea); c++)
+	{
+		const estadistica_t* e = &ventana[c];
+		float sd = (e->n > 1) ? sqrtf(e->m2 / (e->n - 1)) : 0.0f;
+		if (c < THERM_NUM)
+		{
+			snprintf(nombre, sizeof(nombre), "T%d", c + 1);
+		}
+		else if (GRUPOS == 1)
+		{
+			snprintf(nombre, sizeof(nombre), "Media");
+		}
+		else
+		{
+			snprintf(nombre, sizeof(nombre), "M%d", c - THERM_NUM + 1);
+		}
+		len += snprintf(&linea[len], sizeof(linea) - len, " %s %.2f [%.2f, %.2f] sd %.3f;", nombre,
+						e->media / 100.0f, e->min / 100.0f, e->max / 100.0f, sd / 100.0f);
+	}
+	ESP_LOGI(TAG, "VENTANA: n = %u, fallos = %u;%s", (unsigned) ventana[0].n, (unsigned) ventana_fallos, linea);
+
+	for (int c = 0; c < MON_NUM; c++)
+	{
+		estadistica_reset(&ventana[c]);
+	}
+	ventana_fallos = 0;
+}
+
 
 // Tarea MONITOR
 SYSTEM_TASK(TASK_MONITOR)
@@ -41,15 +121,30 @@ SYSTEM_TASK(TASK_MONITOR)
 
 	// Recibe los argumentos de configuración de la tarea y los desempaqueta
 	task_monitor_args_t* ptr_args = (task_monitor_args_t*) TASK_ARGS;
-	RingbufHandle_t* rbuf = ptr_args->rbuf; 
+	canal_t* rbuf = ptr_args->rbuf; 
+	int64_t ventana_us = ptr_args->ventana_ms * 1000LL;
+	int64_t log_us = ptr_args->log_ms * 1000LL;
 
 	// variables para reutilizar en el bucle
 	size_t length;
 	void *ptr;
 	mensaje msg;
-	float lsb1 = 0.0;
-	float lsb2 = 0.0;
-	float lsb3 = 0.0;
+	bool telemetria = ptr_args->telemetria && telemetria_init() == ESP_OK;
+	bool primera = true;
+
+	// Barrera de arranque (ver system_wait_ready); los plazos cuentan desde aquí
+	TASK_READY();
+	int64_t next_dump = esp_timer_get_time() + TRAZA_PERIODO_MS * 1000LL;
+	traza_reset();
+	for (int c = 0; c < MON_NUM; c++)
+	{
+		estadistica_reset(&ventana[c]);
+	}
+	ventana_fallos = 0;
+	int64_t next_ventana = esp_timer_get_time() + ventana_us;
+	int64_t next_log = 0;
+	// Una petición de parada despierta la espera de datos del votador
+	TASK_ON_STOP(canal_despertar, rbuf);
 	//float deviation = 0.0;
 	//float min_val = 0.0;
 	//float max_val = 0.0;
@@ -60,37 +155,106 @@ SYSTEM_TASK(TASK_MONITOR)
 		// Se bloquea en espera de que haya algo que leer en RingBuffer.
 		// Tiene un timeout de 1 segundo para no bloquear indefinidamente la tarea, 
 		// pero si expira vuelve aquí sin consecuencias
-		ptr = xRingbufferReceive(*rbuf, &length, pdMS_TO_TICKS(1000));
+		ptr = canal_receive(rbuf, &length, pdMS_TO_TICKS(1000));
 
 		//Si el timeout expira, este puntero es NULL
 		if (ptr != NULL) 
 		{
-			
-			msg = *((mensaje *) ptr);
-
-			if (msg.uid == ID_VOTADOR){
-				lsb1 = msg.lsb1;
-				lsb2 = msg.lsb2;
-				lsb3 = msg.lsb3;
-				
-				
-				
-				// Muestra las temperaturas de los tres termistores
-				ESP_LOGI(TAG, "NORMAL_MODE: T1 = %.5f; T2 = %.5f; T3 = %.5f", convert_lsb_t(lsb1),
-																				convert_lsb_t(lsb2),
-																				convert_lsb_t(lsb3));
-
-				// Muestra la media convertida a grados centigrados
-				ESP_LOGI(TAG, "NORMAL_MODE: Media = %.5f", convert_lsb_t(msg.media_raw) );
+			TASK_BUSY_BEGIN();
+			// Cada elemento del buffer es un bloque de mensajes
+			size_t n = length / sizeof(mensaje);
+			int64_t now = esp_timer_get_time();
+			for (size_t i = 0; i < n; i++)
+			{
+				msg = ((mensaje *) ptr)[i];
+				traza_registrar(&msg, now);
+
+				if (msg.uid == ID_VOTADOR){
+					if (primera)
+					{
+						// esp_timer cuenta desde el arranque del chip
+						primera = false;
+						ESP_LOGI(TAG, "Primera muestra votada a %u ms del arranque", (unsigned) (now / 1000));
+					}
+					if (telemetria)
+					{
+						telemetria_enviar(&msg);
+					}
+					registro_anotar(&msg);
+
+					// Agregado de la ventana, en punto fijo hasta el volcado
+					if (ventana_us > 0)
+					{
+						for (int c = 0; c < THERM_NUM; c++)
+						{
+							estadistica_add(&ventana[c], calib_cdeg(c, msg.lsb[c]));
+						}
+						for (int g = 0; g < GRUPOS; g++)
+						{
+							estadistica_add(&ventana[THERM_NUM + g], msg.media_cdeg[g]);
+						}
+						ventana_fallos += (msg.fallos != 0);
+					}
+
+					if (!ptr_args->log_muestras || now < next_log)
+					{
+						continue;
+					}
+					next_log = now + log_us;
+
+					// El mensaje solo trae LSB y centésimas de grado: aquí se pasa a float
+					// Muestra las temperaturas de los termistores y la media de cada grupo
+					for (int g = 0; g < GRUPOS; g++)
+					{
+						char linea[SENSORES_GRUPO * 24];
+						int len = 0;
+						for (int s = 0; s < SENSORES_GRUPO; s++)
+						{
+							int c = g * SENSORES_GRUPO + s;
+							len += snprintf(&linea[len], sizeof(linea) - len, "%sT%d = %.5f", s ? "; " : "", c + 1,
+											calib_t(c, msg.lsb[c]));
+						}
+						ESP_LOGI(TAG, "NORMAL_MODE: %s", linea);
+
+						// Media del grupo en grados centigrados, ya calculada por el votador con la
+						// calibración de cada canal; la votada en LSB se muestra tal cual
+						ESP_LOGI(TAG, "NORMAL_MODE: Media %d = %.2f (LSB %u)", g + 1,
+								 msg.media_cdeg[g] / 100.0f, (unsigned) msg.media_raw[g]);
+					}
+				}
 			}
 
-			vRingbufferReturnItem(*rbuf, ptr);
+			canal_return(rbuf, ptr);
+			if (telemetria)
+			{
+				telemetria_flush();
+			}
 		} 
 		else 
 		{
-			ESP_LOGW(TAG, "Esperando datos ...");
+			if (!TASK_STOPPING())
+			{
+				ESP_LOGW(TAG, "Esperando datos ...");
+			}
+			registro_flush();
+		}
+
+		// Resumen de la ventana
+		if (ventana_us > 0 && esp_timer_get_time() >= next_ventana)
+		{
+			ventana_volcar();
+			next_ventana = esp_timer_get_time() + ventana_us;
+		}
+
+		// Estadísticas de latencia: periódicas o cuando otra tarea las pide
+		if (traza_volcado_pendiente() ||
+			(TRAZA_PERIODO_MS > 0 && esp_timer_get_time() >= next_dump))
+		{
+			traza_volcar();
+			next_dump = esp_timer_get_time() + TRAZA_PERIODO_MS * 1000LL;
 		}
 	}
 	ESP_LOGI(TAG,"Deteniendo la tarea ...");
+	registro_flush();
 	TASK_END();
 }
@@ -43,23 +43,100 @@
 #include <esp_event.h>
 #include <esp_log.h>
 #include <esp_timer.h>
-#include <esp_adc/adc_oneshot.h>
 
 // propias
 #include "config.h"
 #include "term.h"
+#include "muestreo.h"
+#include "traza.h"
 
 static const char *TAG = "STF_P1:task_sensor";
 
-// esta tarea temporiza la lectura de un termistor. 
-// Para implementar el periodo de muestreo, se utiliza un semáforo declarado de forma global 
-// para poder ser utilizado desde esta rutina de expiración del timer.
-// Cada vez que el temporizador expira, libera el semáforo
-// para que la tarea realice una iteración. 
-static SemaphoreHandle_t semSample = NULL;
-static void tmrSampleCallback(void* arg)
+// Trama de muestras desentrelazadas del modo continuo
+static uint16_t frame[THERM_CONT_FRAME_SAMPLES * THERM_NUM];
+
+// Bloque de mensajes pendiente de enviar al votador
+static mensaje block[MSG_BATCH_MAX];
+static size_t block_len = 0;
+
+// Filtro y diezmado de las muestras antes de publicarlas
+static filtro_t filtro;
+
+// Sesgo entre canales del modo entrelazado (ver therm_alineado_t)
+static traza_hist_t sesgo;
+static traza_hist_t espejo;
+
+static void sensor_volcar_sesgo(bool interpolar)
+{
+	if (sesgo.n == 0)
+	{
+		return;
+	}
+	ESP_LOGI(TAG, "Sesgo entre canales (us): secuencial p50 %u, max %u; ABC-CBA p50 %u, max %u%s",
+			 (unsigned) traza_percentil(&sesgo, 0.50f), (unsigned) sesgo.max,
+			 (unsigned) traza_percentil(&espejo, 0.50f), (unsigned) espejo.max,
+			 interpolar ? " (corregido por interpolación)" : "");
+}
+
+// Envía el bloque pendiente como un único elemento del buffer cíclico
+static void sensor_flush(canal_t* rbuf)
+{
+	void *ptr;
+
+	if (block_len == 0)
+	{
+		return;
+	}
+
+#if TRAZA_ENABLE
+	uint32_t now = esp_timer_get_time();
+	for (size_t i = 0; i < block_len; i++)
+	{
+		block[i].ts_envio_us = now;
+	}
+#endif
+
+	// Uso del buffer cíclico entre la tarea monitor y sensor. Ver documentación en ESP-IDF
+	// Pide al RingBuffer espacio para escribir el bloque completo. 
+	if (canal_send_acquire(rbuf, &ptr, block_len * sizeof(mensaje), pdMS_TO_TICKS(100)) != pdTRUE)
+	{
+		// Si falla la reserva de memoria, notifica la pérdida del dato. Esto ocurre cuando 
+		// una tarea productora es mucho más rápida que la tarea consumidora. Aquí no debe ocurrir.
+		ESP_LOGI(TAG,"Buffer lleno. Espacio disponible: %u", (unsigned) canal_free(rbuf));
+	}
+	else 
+	{
+		// Si xRingbufferSendAcquire tiene éxito, podemos escribir el número de bytes solicitados
+		// en el puntero ptr. El espacio asignado estará bloqueado para su lectura hasta que 
+		// se notifique que se ha completado la escritura
+		memcpy(ptr, block, block_len * sizeof(mensaje));
+
+		// Se notifica que la escritura ha completado. 
+		canal_send_complete(rbuf, ptr);
+	}
+	block_len = 0;
+}
+
+// Añade un mensaje al bloque y lo envía cuando tiene `batch` mensajes
+static void sensor_publish(canal_t* rbuf, const mensaje* msg, size_t batch)
+{
+	block[block_len++] = *msg;
+	if (block_len >= batch)
+	{
+		sensor_flush(rbuf);
+	}
+}
+
+// Pasa una muestra adquirida por el filtro y publica cuando el diezmado lo indica.
+// La marca de tiempo y la secuencia son las de la muestra publicada.
+static void sensor_filter(canal_t* rbuf, mensaje* msg, const uint16_t* lsb, uint32_t ts_us, size_t batch)
 {
-	xSemaphoreGive(semSample);
+	if (filtro_muestra(&filtro, lsb, msg->lsb))
+	{
+		msg->ts_us = ts_us;
+		msg->seq++;
+		sensor_publish(rbuf, msg, batch);
+	}
 }
 
 
@@ -71,104 +148,160 @@ SYSTEM_TASK(TASK_SENSOR)
 
 	// Recibe los argumentos de configuración de la tarea y los desempaqueta
 	task_sensor_args_t* ptr_args = (task_sensor_args_t*) TASK_ARGS;
-	RingbufHandle_t* rbuf = ptr_args->rbuf; 
-	uint8_t frequency = ptr_args->freq;
-	uint64_t period_us = 1000000 / frequency;
+	canal_t* rbuf = ptr_args->rbuf; 
+	uint32_t periodo_ns = ptr_args->periodo_ns;
+	sensor_acq_t acq = ptr_args->acq;
+	bool interpolar = ptr_args->interpolar;
+	size_t batch = ptr_args->batch;
+	if (batch < 1) batch = 1;
+	if (batch > MSG_BATCH_MAX) batch = MSG_BATCH_MAX;
+	block_len = 0;
+	memset(&sesgo, 0, sizeof(sesgo));
+	memset(&espejo, 0, sizeof(espejo));
+	ESP_ERROR_CHECK(filtro_init(&filtro, &ptr_args->filtro, THERM_NUM));
+	const therm_chan_t channels[THERM_NUM] = THERM_CANALES;
 
-	therm_init();
+	// Watchdog software: si el tick se retrasa más de un 20 % del periodo el
+	// sistema se reinicia. Se redondea hacia arriba a ticks del RTOS y se suma
+	// uno por la fase del tick, así que a kHz queda en 1-2 ticks y nunca en 0.
+	const uint64_t tick_ns = (uint64_t) portTICK_PERIOD_MS * 1000000;
+	TickType_t watchdog = (TickType_t) (((uint64_t) periodo_ns * 12 / 10 + tick_ns - 1) / tick_ns) + 1;
+#if INFORME_PERIODO_MS > 0
+	uint32_t informe_us = esp_timer_get_time();
+#endif
 
-	// Inicializa el semásforo (la estructura del manejador se definió globalmente)
-	semSample = xSemaphoreCreateBinary();
+	mensaje msg = {0};
+	msg.uid = ID_SENSOR;
 
-	// Crea y establece una estructura de configuración para el temporizador
-	const esp_timer_create_args_t tmrSampleArgs = {
-		.callback = &tmrSampleCallback,
-		.name = "Timer Configuration"
-	};
+	//mensaje msg_comprobador;
+	//msg_comprobador.uid = ID_SENSOR;
+	therm_t therms[THERM_NUM];
+	uint32_t cont_watchdog_ms = 0;
 
-	// Lanza el temporizador, conel periodo de muestreo recibido como parámetro
-	esp_timer_handle_t tmrSample;
-	ESP_ERROR_CHECK(esp_timer_create(&tmrSampleArgs, &tmrSample));
-	ESP_ERROR_CHECK(esp_timer_start_periodic(tmrSample, period_us));
-	
-	// variables para reutilizar en el bucle
-	void *ptr;
+	if (acq == SENSOR_ACQ_CONTINUOUS)
+	{
+		// En modo continuo el propio ADC marca el ritmo: no hay temporizador ni
+		// lecturas oneshot, la tarea solo despierta cuando llega una trama por DMA.
+		// El ADC empieza a convertir al arrancarlo: se espera antes a la barrera de arranque.
+		TASK_READY();
+		ESP_ERROR_CHECK(therm_cont_start(channels, THERM_NUM, ptr_args->cont_freq));
+		// Plazo del watchdog: dos tramas a la frecuencia efectiva, más un segundo de margen
+		cont_watchdog_ms = 2u * THERM_CONT_FRAME_SAMPLES * THERM_NUM * 1000u / therm_cont_freq() + 1000u;
+	}
+	else
+	{
+		therm_init();
 
-	float v1 = 20.0;
-	float v2 = 20.0;
-	float v3 = 20.0;
+		for (int i = 0; i < THERM_NUM; i++)
+		{
+			therm_config( &therms[i], channels[i], -1);
+		}
 
-	mensaje msg;
-	msg.uid = ID_SENSOR;
+		// ADC listo. El primer tick se programa cuando votador y monitor también lo están
+		TASK_READY();
 
-	//mensaje msg_comprobador;
-	//msg_comprobador.uid = ID_SENSOR;
-	therm_t t1;
-	therm_t t2;
-	therm_t t3;
-	therm_config( &t1, ADC_CHANNEL_6, -1);
-	therm_config( &t2, ADC_CHANNEL_5, -1);
-	therm_config( &t3, ADC_CHANNEL_0, -1);
+		// El periodo de muestreo lo marca el temporizador hardware (ver muestreo.h).
+		// Una petición de parada despierta la espera del tick
+		ESP_ERROR_CHECK(muestreo_start(periodo_ns));
+		TASK_ON_STOP(muestreo_despertar, NULL);
+	}
 
 	// Loop
 	TASK_LOOP()
 	{
-		// Se bloquea a la espera del semáforo. Si el periodo establecido se retrasa un 20%
+		if (acq == SENSOR_ACQ_CONTINUOUS)
+		{
+			// Espera una trama completa. Si no llega en cont_watchdog_ms el ADC se ha
+			// detenido y, como en el modo oneshot, se reinicia por seguridad. El
+			// driver no ofrece nada con que despertar la espera, así que se hace en
+			// tramos de SYSTEM_STOP_POLL_MS para atender a tiempo una petición de parada
+			// y llegar a therm_cont_stop() en lugar de ser eliminada con el DMA activo.
+			size_t n = 0;
+			for (uint32_t espera_ms = 0; n == 0 && espera_ms < cont_watchdog_ms && !TASK_STOPPING();
+				 espera_ms += SYSTEM_STOP_POLL_MS)
+			{
+				n = therm_cont_read(frame, THERM_CONT_FRAME_SAMPLES, SYSTEM_STOP_POLL_MS);
+			}
+			if (n == 0)
+			{
+				// Una parada pedida durante la espera no es un fallo del ADC
+				if (TASK_STOPPING())
+				{
+					break;
+				}
+				ESP_LOGI(TAG,"Watchdog (soft) failed");
+				esp_restart();
+			}
+			TASK_BUSY_BEGIN();
+			// La trama acaba de completarse: la muestra i se tomó (n-1-i) periodos antes
+			uint32_t now = esp_timer_get_time();
+			uint32_t sample_us = 1000000u * THERM_NUM / therm_cont_freq();
+			for (size_t i = 0; i < n; i++)
+			{
+				sensor_filter(rbuf, &msg, &frame[i * THERM_NUM], now - (n - 1 - i) * sample_us, batch);
+			}
+			continue;
+		}
+
+		// Se bloquea a la espera del siguiente tick. Si el periodo establecido se retrasa un 20%
 		// el sistema se reinicia por seguridad. Este mecanismo de watchdog software es útil
 		// en tareas periódicas cuyo periodo es conocido. 
-		if(xSemaphoreTake(semSample, ((1000/frequency)*1.2)/portTICK_PERIOD_MS))
+		uint32_t tick_us;
+		if (muestreo_esperar(watchdog, &tick_us))
 		{	
-			// lectura del sensor 1
-			v1 = therm_read_t(t1);
-			msg.s1 = v1;
-			msg.lsb1 = therm_read_lsb(t1);
-			//ESP_LOGI(TAG, "valor medido de s1 (pre buffer): %.5f", v1);
-			//ESP_LOGI(TAG, "valor medido de lsb1 (pre buffer): %u", (unsigned int) msg.lsb1);
-			
-
-			// lectura del sensor 2
-			v2 = therm_read_t(t2);
-			msg.s2 = v2;
-			msg.lsb2 = therm_read_lsb(t2);
-			//ESP_LOGI(TAG, "valor medido de s2 (pre buffer): %.5f", v2);
-			//ESP_LOGI(TAG, "valor medido de lsb2 (pre buffer): %u", (unsigned int) msg.lsb2);
-
-			// lectura del sensor 3
-			v3 = therm_read_t(t3);
-			msg.s3 = v3;
-			msg.lsb3 = therm_read_lsb(t3);
-			//ESP_LOGI(TAG, "valor medido de s3 (pre buffer): %.5f", v3);
-			//ESP_LOGI(TAG, "valor medido de lsb3 (pre buffer): %u", (unsigned int) msg.lsb3);
-
-			// Uso del buffer cíclico entre la tarea monitor y sensor. Ver documentación en ESP-IDF
-			// Pide al RingBuffer espacio para escribir un float. 
-			if (xRingbufferSendAcquire(*rbuf, &ptr, sizeof(mensaje), pdMS_TO_TICKS(100)) != pdTRUE)
+			TASK_BUSY_BEGIN();
+			// lectura de los sensores: una conversión por canal o, en modo entrelazado,
+			// dos en orden espejo alineadas a un mismo instante. La conversión a
+			// temperatura no se hace aquí: el mensaje solo lleva los LSB
+			uint16_t lsb[THERM_NUM];
+			if (acq == SENSOR_ACQ_ENTRELAZADO)
 			{
-				// Si falla la reserva de memoria, notifica la pérdida del dato. Esto ocurre cuando 
-				// una tarea productora es mucho más rápida que la tarea consumidora. Aquí no debe ocurrir.
-				ESP_LOGI(TAG,"Buffer lleno. Espacio disponible: %d", xRingbufferGetCurFreeSize(*rbuf));
+				therm_alineado_t al;
+				ESP_ERROR_CHECK(therm_read_aligned(therms, THERM_NUM, interpolar, lsb, &al));
+				traza_hist_add(&sesgo, al.sesgo_us);
+				traza_hist_add(&espejo, al.espejo_us);
 			}
-			else 
+			else
 			{
-				// Si xRingbufferSendAcquire tiene éxito, podemos escribir el número de bytes solicitados
-				// en el puntero ptr. El espacio asignado estará bloqueado para su lectura hasta que 
-				// se notifique que se ha completado la escritura
-				memcpy(ptr,&msg, sizeof(mensaje));
+				ESP_ERROR_CHECK(therm_read_all(therms, THERM_NUM, lsb, NULL));
+			}
+			//ESP_LOGI(TAG, "valor medido de lsb1 (pre buffer): %u", (unsigned int) lsb[0]);
 
-				// Se notifica que la escritura ha completado. 
-				xRingbufferSendComplete(*rbuf, ptr);
+			// La muestra lleva el instante programado del tick, no el de la lectura
+			sensor_filter(rbuf, &msg, lsb, tick_us, batch);
+#if INFORME_PERIODO_MS > 0
+			if (tick_us - informe_us >= INFORME_PERIODO_MS * 1000u)
+			{
+				informe_us = tick_us;
+				muestreo_volcar();
+				sensor_volcar_sesgo(interpolar);
 			}
+#endif
 		}
 		else
 		{
+			// Igual que en modo continuo: si la espera se interrumpe para parar, no se reinicia
+			if (TASK_STOPPING())
+			{
+				break;
+			}
 			ESP_LOGI(TAG,"Watchdog (soft) failed");
 			esp_restart();
 		}
 	}
 	
 	ESP_LOGI(TAG,"Deteniendo la tarea...");
+	sensor_flush(rbuf);
 	// detención controlada de las estructuras que ha levantado la tarea
-	ESP_ERROR_CHECK(esp_timer_stop(tmrSample));
-	ESP_ERROR_CHECK(esp_timer_delete(tmrSample));
+	if (acq == SENSOR_ACQ_CONTINUOUS)
+	{
+		ESP_ERROR_CHECK(therm_cont_stop());
+	}
+	else
+	{
+		ESP_ERROR_CHECK(muestreo_stop());
+		muestreo_volcar();
+		sensor_volcar_sesgo(interpolar);
+	}
 	TASK_END();
 }
\ No newline at end of file
@@ -3,101 +3,191 @@
 #include <freertos/semphr.h>
 #include <freertos/ringbuf.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include <math.h>
 
 #include "config.h"
+#include "term.h"
+#include "votador.h"
+#include "calibracion.h"
 
 static const char *TAG = "STF_P1:task_votador";
 
+// Si el buffer del Monitor está lleno el trozo se vota aquí igualmente, para no
+// saltarse las comprobaciones; solo se pierde el reenvío
+static mensaje descarte[MSG_BATCH_MAX];
+
 SYSTEM_TASK(TASK_VOTADOR) {
     TASK_BEGIN();
     ESP_LOGI(TAG, "Task votador running");
 
     // Desempaquetar argumentos de configuración
     task_votador_args_t* args = (task_votador_args_t*) TASK_ARGS;
-    RingbufHandle_t* rbuf_read = args->rbuf_read;
-    RingbufHandle_t* rbuf_write = args->rbuf_write;
+    canal_t* rbuf_read = args->rbuf_read;
+    canal_t* rbuf_write = args->rbuf_write;
     uint16_t mask = args->mask;
 
+    uint16_t batch = args->batch;
+    if (batch < 1) batch = 1;
+    if (batch > MSG_BATCH_MAX) batch = MSG_BATCH_MAX;
+    votador_modo_t modo = args->modo;
+    votador_tol_t tol_unidad = args->tol_unidad;
+    uint16_t tol = args->tol;
+
+    // Filtro de las peticiones de cambio de estado (ver system_hysteresis_t)
+    system_hysteresis_t hyst;
+    system_hysteresis_init(&hyst, args->histeresis);
+
     void *ptr_receive = NULL;
     void *ptr_send = NULL;
     size_t length;
 
-    float media = 0.0;
-    uint16_t R;
+    // Una petición de parada despierta la espera de datos del sensor
+    TASK_ON_STOP(canal_despertar, rbuf_read);
 
-    mensaje msg_received;
-    mensaje msg_send;
-    msg_send.uid = ID_VOTADOR;
+    // Barrera de arranque (ver system_wait_ready)
+    TASK_READY();
 
     // Loop
     TASK_LOOP() {
-        // Recibir datos del buffer del Sensor
-        ptr_receive = xRingbufferReceive(*rbuf_read, &length, pdMS_TO_TICKS(1000));
+        // Recibir datos del buffer del Sensor. Cada elemento es un bloque de
+        // uno o varios mensajes (ver task_sensor_args_t.batch)
+        ptr_receive = canal_receive(rbuf_read, &length, pdMS_TO_TICKS(1000));
 
         if (ptr_receive != NULL) {
+            TASK_BUSY_BEGIN();
             
-            msg_received = *((mensaje*) ptr_receive);
-            //ESP_LOGI(TAG, "Mensaje Recibido");
-            
-            media = (msg_received.s1 + msg_received.s2 + msg_received.s3) / 3.0;
-
-            R = (msg_received.lsb1 & msg_received.lsb2 ) |
-                (msg_received.lsb2 & msg_received.lsb3 ) | 
-                (msg_received.lsb1 & msg_received.lsb3 );
-
-            msg_send.lsb1 = msg_received.lsb1;
-            msg_send.lsb2 = msg_received.lsb2;
-            msg_send.lsb3 = msg_received.lsb3;
-
-            msg_send.media = media;
-            msg_send.media_raw = R;
-
-            // COMPROBACIONES Y CAMBIO DE ESTADO
-            if (((msg_received.lsb1 & mask) != (msg_received.lsb2 & mask)) ||
-                ((msg_received.lsb2 & mask) != (msg_received.lsb3 & mask)) ||
-                ((msg_received.lsb1 & mask) != (msg_received.lsb3 & mask))) {
-                
-                ESP_LOGW(TAG, "Inconsistencia detectada entre las mediciones.");
-                
-                if ((msg_received.lsb1 & mask) != (msg_received.lsb2 & mask)) {
-                    ESP_LOGW(TAG, "Error en el sensor 1 detectado. Cambiando estado a SENSOR1_FAILURE.");
-                    SWITCH_ST_FROM_TASK(SENSOR1_FAILURE);
-                } else if ((msg_received.lsb2 & mask) != (msg_received.lsb3 & mask)) {
-                    ESP_LOGW(TAG, "Error en el sensor 2 detectado. Cambiando estado a SENSOR2_FAILURE.");
-                    SWITCH_ST_FROM_TASK(SENSOR2_FAILURE);
-                } else if ((msg_received.lsb1 & mask) != (msg_received.lsb3 & mask)) {
-                    ESP_LOGW(TAG, "Error en el sensor 3 detectado. Cambiando estado a SENSOR3_FAILURE.");
-                    SWITCH_ST_FROM_TASK(SENSOR3_FAILURE);
+            const mensaje* block_received = (const mensaje*) ptr_receive;
+            size_t n_received = length / sizeof(mensaje);
+
+            // El bloque se reenvía al monitor en trozos de como mucho `batch` mensajes,
+            // con una sola reserva en el buffer de salida por trozo
+            for (size_t first = 0; first < n_received; first += batch) {
+                size_t n = n_received - first;
+                if (n > batch) {
+                    n = batch;
+                }
+
+                // Preparar bloque para Monitor
+                bool reenviar = true;
+                if (canal_send_acquire(rbuf_write, &ptr_send, n * sizeof(mensaje), pdMS_TO_TICKS(100)) != pdTRUE) {
+                    ESP_LOGW(TAG, "Buffer Monitor lleno. Descartando %u mensajes.", (unsigned) n);
+                    ptr_send = descarte;
+                    reenviar = false;
+                }
+                mensaje* block_send = (mensaje*) ptr_send;
+#if TRAZA_ENABLE
+                uint32_t now = esp_timer_get_time();
+#endif
+
+                // Sin copias intermedias: cada mensaje se escribe directamente en su
+                // hueco del bloque de salida, leyendo del hueco del bloque de entrada
+                for (size_t i = 0; i < n; i++) {
+                    const mensaje* in = &block_received[first + i];
+                    mensaje* out = &block_send[i];
+                    //ESP_LOGI(TAG, "Mensaje Recibido");
+
+                    out->ts_us = in->ts_us;
+                    out->seq = in->seq;
+#if TRAZA_ENABLE
+                    out->ts_envio_us = in->ts_envio_us;
+                    out->ts_voto_us = now;
+#endif
+                    memcpy(out->lsb, in->lsb, sizeof(out->lsb));
+                    out->fallos = 0;
+                    out->uid = ID_VOTADOR;
+                }
+
+                // Voto de todo el trozo, grupo a grupo: escribe media_raw y fallos (y en
+                // modo analógico media_cdeg) directamente en el bloque de salida
+                votador_resumen_t res = {0};
+                for (int g = 0; g < GRUPOS; g++) {
+                    if (modo == VOTADOR_MODO_ANALOGICO) {
+                        votador_analogico(block_send, block_send, n, g, tol_unidad, tol, &res);
+                        continue;
+                    }
+                    votador_tmr(block_send, block_send, n, g, mask, &res);
+
+                    // Media en centésimas de grado (tabla de cada canal, sin floats)
+                    for (size_t i = 0; i < n; i++) {
+                        const uint16_t* lsb = &block_send[i].lsb[g * SENSORES_GRUPO];
+                        int32_t suma = 0;
+                        for (int s = 0; s < SENSORES_GRUPO; s++) {
+                            suma += calib_cdeg(g * SENSORES_GRUPO + s, lsb[s]);
+                        }
+                        block_send[i].media_cdeg[g] = suma / SENSORES_GRUPO;
+                    }
                 }
-            }
 
-            // Log para depuración
-            //ESP_LOGI(TAG, "Media calculada: %.2f", media);
+                // COMPROBACIONES Y CAMBIO DE ESTADO
+                // Un sensor está en fallo cuando discrepa de la mayoría de su grupo; si
+                // en algún grupo discrepan más de los que permite la mayoría no hay
+                // lectura fiable. El cambio de estado no bloquea y solo se pide tras
+                // `histeresis` muestras seguidas con fallo; una muestra correcta
+                // reinicia la cuenta. Los sensores afectados quedan en el mapa de
+                // votador_sensores_fallidos() con cada muestra en fallo, se pida o no el
+                // cambio: estando ya en SENSOR_FAILURE la petición se descarta, pero un
+                // segundo sensor que falla tiene que quedar registrado.
+                if (!res.fallos) {
+                    system_hysteresis_clear(&hyst);
+                } else {
+                    for (size_t i = 0; i < n; i++) {
+                        therm_mapa_t fallos = block_send[i].fallos;
+                        if (fallos == 0) {
+                            system_hysteresis_clear(&hyst);
+                            continue;
+                        }
+
+                        therm_mapa_t antes = votador_sensores_fallidos();
+                        if (votador_marcar_fallidos(fallos)) {
+                            ESP_LOGW(TAG, "Nuevos sensores en fallo (seq %u): 0x%0*X; mapa de fallidos 0x%0*X.",
+                                     block_send[i].seq, (THERM_NUM + 3) / 4, (unsigned) (fallos & ~antes),
+                                     (THERM_NUM + 3) / 4, (unsigned) (fallos | antes));
+                        }
+
+                        uint8_t st = votador_sin_mayoria(fallos) ? TOTAL_FAILURE : SENSOR_FAILURE;
+                        if (SWITCH_ST_FROM_TASK_HYST(&hyst, st) != pdTRUE) {
+                            continue;
+                        }
+
+                        // Solo se informa de las peticiones que llegan a la máquina de estados
+                        ESP_LOGW(TAG, "Inconsistencia detectada entre las mediciones (seq %u, fallos 0x%0*X).",
+                                 block_send[i].seq, (THERM_NUM + 3) / 4, (unsigned) fallos);
+                        for (int c = 0; c < THERM_NUM; c++) {
+                            if (!(fallos & VOTADOR_FALLO(c))) {
+                                continue;
+                            }
+                            if (modo == VOTADOR_MODO_ANALOGICO) {
+                                ESP_LOGW(TAG, "  sensor %d (grupo %d): LSB %u, mediana %u", c + 1, c / SENSORES_GRUPO,
+                                         block_send[i].lsb[c], block_send[i].media_raw[c / SENSORES_GRUPO]);
+                            } else {
+                                ESP_LOGW(TAG, "  sensor %d (grupo %d): bits %03X", c + 1, c / SENSORES_GRUPO,
+                                         res.bits[c] & mask);
+                            }
+                        }
+                        if (st == TOTAL_FAILURE) {
+                            ESP_LOGE(TAG, "Sin mayoría entre los sensores. Cambiando estado a TOTAL_FAILURE.");
+                        } else {
+                            ESP_LOGW(TAG, "Error en %d sensor(es) detectado. Cambiando estado a SENSOR_FAILURE.",
+                                     votador_num_fallos(fallos));
+                        }
+                    }
+                }
 
-            // Preparar mensaje para Monitor
-            if (xRingbufferSendAcquire(*rbuf_write, &ptr_send, sizeof(mensaje), pdMS_TO_TICKS(100)) != pdTRUE) {
-                ESP_LOGW(TAG, "Buffer Monitor lleno. Descartando datos.");
+                // Se notifica que la escritura del bloque ha completado. 
+                if (reenviar) {
+                    canal_send_complete(rbuf_write, ptr_send);
+                }
             }
-            else 
-			{
-				// Si xRingbufferSendAcquire tiene éxito, podemos escribir el número de bytes solicitados
-				// en el puntero ptr. El espacio asignado estará bloqueado para su lectura hasta que 
-				// se notifique que se ha completado la escritura
-				memcpy(ptr_send, &msg_send, sizeof(mensaje));
-
-				// Se notifica que la escritura ha completado. 
-				xRingbufferSendComplete(*rbuf_write, ptr_send);
-			}
             
             // Liberar elemento del buffer
-            vRingbufferReturnItem(*rbuf_read, ptr_receive);
-        } else {
+            canal_return(rbuf_read, ptr_receive);
+        } else if (!TASK_STOPPING()) {
             ESP_LOGW(TAG, "Esperando datos del Sensor...");
         }
     }
 
-    ESP_LOGI(TAG, "Deteniendo la tarea Comprobador...");
+    ESP_LOGI(TAG, "Deteniendo la tarea Comprobador... (%u peticiones de estado suprimidas)", (unsigned) hyst.suppressed);
     TASK_END();
 }
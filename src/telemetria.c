@@ -0,0 +1,202 @@
+// Telemetría binaria (ver telemetria.h)
+#include <stdio.h>
+#include <string.h>
+
+#include <sdkconfig.h>
+#include <esp_log.h>
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include <driver/uart.h>
+#endif
+
+#include "config.h"
+#include "telemetria.h"
+
+static const char *TAG = "STF_P1:telemetria";
+
+// Buffer de salida: se acumulan tramas y se escriben de una vez
+static uint8_t salida[TELEMETRIA_BUF];
+static size_t salida_len = 0;
+
+// Último registro enviado, referencia de las diferencias
+static mensaje anterior;
+static uint32_t hasta_clave = 0;
+
+static uint32_t tramas = 0;
+static uint32_t bytes = 0;
+
+#if CONFIG_IDF_TARGET_LINUX
+static FILE *fichero = NULL;
+#endif
+
+static uint16_t crc16(const uint8_t *p, size_t n)
+{
+	uint16_t crc = 0xFFFF;
+	while (n--)
+	{
+		crc ^= (uint16_t) *p++ << 8;
+		for (int b = 0; b < 8; b++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static inline uint8_t *varint(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static inline uint8_t *zigzag(uint8_t *p, int32_t v)
+{
+	return varint(p, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+}
+
+// COBS: elimina los 0x00 del registro para poder usarlo como delimitador. La
+// trama lleva uno delante y otro detrás: el texto de la consola que se cuele
+// entre dos tramas queda aislado y no se pega al principio de la siguiente
+static size_t cobs(const uint8_t *in, size_t n, uint8_t *out)
+{
+	*out++ = 0x00;
+	uint8_t *codigo = out;
+	uint8_t *p = out + 1;
+	uint8_t cuenta = 1;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (in[i] != 0)
+		{
+			*p++ = in[i];
+			cuenta++;
+		}
+		if (in[i] == 0 || cuenta == 0xFF)
+		{
+			*codigo = cuenta;
+			codigo = p++;
+			cuenta = 1;
+		}
+	}
+	*codigo = cuenta;
+	*p++ = 0x00;
+	return p - out + 1;
+}
+
+size_t telemetria_codificar(const mensaje *msg, uint8_t *trama)
+{
+	uint8_t reg[TELEMETRIA_MAX_REG];
+	uint8_t *p = reg;
+
+	if (hasta_clave == 0)
+	{
+		// Registro clave: valores absolutos (diferencia con un anterior a cero)
+		*p++ = TELEMETRIA_REG_CLAVE;
+		*p++ = THERM_NUM;
+		*p++ = GRUPOS;
+		memset(&anterior, 0, sizeof(anterior));
+		hasta_clave = TELEMETRIA_CLAVE;
+	}
+	else
+	{
+		// La base de las diferencias: el receptor comprueba que es la suya
+		*p++ = TELEMETRIA_REG_DELTA;
+		*p++ = anterior.seq & 0xFF;
+	}
+	hasta_clave--;
+
+	*p++ = msg->seq & 0xFF;
+	*p++ = msg->seq >> 8;
+	p = zigzag(p, (int32_t) (msg->ts_us - anterior.ts_us));
+	for (int c = 0; c < THERM_NUM; c++)
+	{
+		p = zigzag(p, (int32_t) msg->lsb[c] - anterior.lsb[c]);
+	}
+	for (int g = 0; g < GRUPOS; g++)
+	{
+		p = zigzag(p, (int32_t) msg->media_raw[g] - anterior.media_raw[g]);
+		p = zigzag(p, (int32_t) msg->media_cdeg[g] - anterior.media_cdeg[g]);
+	}
+	p = varint(p, msg->fallos);
+
+	uint16_t crc = crc16(reg, p - reg);
+	*p++ = crc & 0xFF;
+	*p++ = crc >> 8;
+
+	anterior = *msg;
+	return cobs(reg, p - reg, trama);
+}
+
+static void telemetria_escribir(const uint8_t *p, size_t n)
+{
+#if CONFIG_IDF_TARGET_LINUX
+	if (fichero != NULL)
+	{
+		fwrite(p, 1, n, fichero);
+		fflush(fichero);
+	}
+#else
+	uart_write_bytes(TELEMETRIA_UART, p, n);
+#endif
+	bytes += n;
+}
+
+esp_err_t telemetria_init(void)
+{
+	salida_len = 0;
+	hasta_clave = 0;
+	tramas = 0;
+	bytes = 0;
+#if CONFIG_IDF_TARGET_LINUX
+	fichero = fopen(TELEMETRIA_FICHERO, "wb");
+	if (fichero == NULL)
+	{
+		ESP_LOGE(TAG, "No se puede crear %s", TELEMETRIA_FICHERO);
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "Telemetría binaria en %s", TELEMETRIA_FICHERO);
+#else
+	// La consola escribe en la UART sin driver; para enviar bloques binarios sin
+	// traducción de fin de línea se instala el driver (solo transmisión)
+	if (!uart_is_driver_installed(TELEMETRIA_UART))
+	{
+		ESP_ERROR_CHECK(uart_driver_install(TELEMETRIA_UART, 256, 2 * TELEMETRIA_BUF, 0, NULL, 0));
+	}
+	ESP_LOGI(TAG, "Telemetría binaria en UART%d", TELEMETRIA_UART);
+#endif
+	return ESP_OK;
+}
+
+void telemetria_enviar(const mensaje *msg)
+{
+	if (salida_len + TELEMETRIA_MAX_TRAMA > sizeof(salida))
+	{
+		telemetria_flush();
+	}
+	salida_len += telemetria_codificar(msg, &salida[salida_len]);
+	tramas++;
+}
+
+void telemetria_flush(void)
+{
+	if (salida_len > 0)
+	{
+		telemetria_escribir(salida, salida_len);
+		salida_len = 0;
+	}
+}
+
+uint32_t telemetria_tramas(void)
+{
+	return tramas;
+}
+
+uint32_t telemetria_bytes(void)
+{
+	return bytes;
+}
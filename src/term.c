@@ -1,38 +1,87 @@
 
 #include <esp_err.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <math.h>
 #include "term.h"
+#include "config.h" // BENCH_ENABLE
 
- adc_oneshot_unit_handle_t adc_hdlr;
- adc_oneshot_unit_init_cfg_t unit_cfg = {
- .unit_id = ADC_UNIT_1,
- .clk_src = ADC_RTC_CLK_SRC_DEFAULT,
- };
+#if !CONFIG_IDF_TARGET_LINUX
+// Una instancia oneshot por unidad; se crean al configurar su primer canal
+static adc_oneshot_unit_handle_t adc_hdlr[THERM_ADC_UNITS];
 
-esp_err_t therm_init() {
-    
-    // Inicializa el ADC One-Shot
-    adc_oneshot_unit_init_cfg_t init_cfg = {
-        .unit_id = ADC_UNIT_1, // Usa ADC_UNIT_1 como predeterminado
+// Backend ADC oneshot del ESP32
+static esp_err_t adc_backend_init(void) {
+    return ESP_OK;
+}
+
+static esp_err_t adc_backend_config(adc_unit_t unit, adc_channel_t channel) {
+    if (unit >= THERM_ADC_UNITS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (adc_hdlr[unit] == NULL) {
+        adc_oneshot_unit_init_cfg_t unit_cfg = {
+            .unit_id = unit,
+            .clk_src = ADC_RTC_CLK_SRC_DEFAULT,
+        };
+        esp_err_t ret = adc_oneshot_new_unit(&unit_cfg, &adc_hdlr[unit]);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    // Configura el canal ADC
+    adc_oneshot_chan_cfg_t chan_cfg = {
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+        .atten = THERM_ADC_ATTEN,  // Configuración típica para medir hasta ~3.3V
     };
+    return adc_oneshot_config_channel(adc_hdlr[unit], channel, &chan_cfg);
+}
+
+static esp_err_t adc_backend_read(adc_unit_t unit, adc_channel_t channel, int* raw) {
+    return adc_oneshot_read(adc_hdlr[unit], channel, raw);
+}
+
+const therm_backend_t therm_backend_adc = {
+    .name = "adc_oneshot",
+    .init = adc_backend_init,
+    .config = adc_backend_config,
+    .read = adc_backend_read,
+};
+#endif
+
+// Backend activo. En linux no hay ADC, así que por defecto se simula
+#if CONFIG_IDF_TARGET_LINUX
+static const therm_backend_t* backend = &therm_backend_sim;
+#else
+static const therm_backend_t* backend = &therm_backend_adc;
+#endif
+
+esp_err_t therm_set_backend(const therm_backend_t* new_backend) {
+    if (new_backend == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    backend = new_backend;
+    return ESP_OK;
+}
+
+const therm_backend_t* therm_get_backend(void) {
+    return backend;
+}
+
+esp_err_t therm_init() {
     
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit_cfg, &adc_hdlr));
+    ESP_ERROR_CHECK(backend->init());
     return ESP_OK; // Inicialización exitosa
 }
 
-esp_err_t therm_config(therm_t* thermistor, adc_channel_t channel, int gpio_pin) {
+esp_err_t therm_config(therm_t* thermistor, therm_chan_t chan, int gpio_pin) {
 
-    // Almacena el ADC handle y el canal en la estructura del termistor
-    thermistor->adc_channel = channel;
+    // Almacena el canal en la estructura del termistor
+    thermistor->adc_unit = chan.unit;
+    thermistor->adc_channel = chan.channel;
     thermistor->gpio_pin = gpio_pin;
 
-    // Configura el canal ADC
-    adc_oneshot_chan_cfg_t chan_cfg = {
-        .bitwidth = ADC_BITWIDTH_DEFAULT,
-        .atten = ADC_ATTEN_DB_11,  // Configuración típica para medir hasta ~3.3V
-    };
-
+#if !CONFIG_IDF_TARGET_LINUX
     if(gpio_pin != -1){
         // Configurar el GPIO como salida
         gpio_config_t io_conf = {};
@@ -43,9 +92,10 @@ esp_err_t therm_config(therm_t* thermistor, adc_channel_t channel, int gpio_pin)
         io_conf.pull_up_en = GPIO_PULLUP_DISABLE;      // No habilitar pull-up
         gpio_config(&io_conf);
     }
+#endif
 
-
-    esp_err_t ret = adc_oneshot_config_channel(adc_hdlr, channel, &chan_cfg);
+    // Configura el canal ADC
+    esp_err_t ret = backend->config(chan.unit, chan.channel);
     if (ret != ESP_OK) {
         return ret; // Devuelve error si la configuración del canal falla
     }
@@ -54,11 +104,15 @@ esp_err_t therm_config(therm_t* thermistor, adc_channel_t channel, int gpio_pin)
 }
 
 void therm_up(therm_t thermistor){
+#if !CONFIG_IDF_TARGET_LINUX
     ESP_ERROR_CHECK(gpio_set_level(thermistor.gpio_pin, 1));
+#endif
 }
 
 void therm_down(therm_t thermistor){
+#if !CONFIG_IDF_TARGET_LINUX
     ESP_ERROR_CHECK(gpio_set_level(thermistor.gpio_pin, 0));
+#endif
 }
 
 // termistor 1
@@ -74,14 +128,91 @@ float therm_read_v(therm_t t1){
 }
 
 float therm_read_t( therm_t t1){
-    float v = therm_read_v(t1);
-    float r_ntc = SERIES_RESISTANCE * (3.3 - v) / v;
-    float t_kelvin = 1.0f / (1.0f / NOMINAL_TEMPERATURE + (1.0f / BETA_COEFFICIENT) * log(r_ntc / NOMINAL_RESISTANCE));
-    // Resultado en grados centígrados
-    return(t_kelvin - 273.15f); 
+    return convert_lsb_t(therm_read_lsb(t1));
 }
 
-float convert_lsb_t(uint16_t lsb_value){
+therm_sample_t therm_read(therm_t t1){
+    therm_sample_t sample;
+    sample.lsb = therm_read_lsb(t1);
+    sample.t = convert_lsb_t(sample.lsb);
+    return sample;
+}
+
+esp_err_t therm_read_all(const therm_t* thermistors, size_t n, uint16_t* lsb, float* t){
+    // Primero todas las conversiones, seguidas, para que las muestras queden lo
+    // más próximas posible en el tiempo; la conversión a temperatura va después
+    for (size_t i = 0; i < n; i++) {
+        int raw_value = 0;
+        esp_err_t ret = backend->read(thermistors[i].adc_unit, thermistors[i].adc_channel, &raw_value);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        lsb[i] = raw_value;
+    }
+    if (t != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            t[i] = convert_lsb_t(lsb[i]);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t therm_read_aligned(const therm_t* thermistors, size_t n, bool interpolar, uint16_t* lsb, therm_alineado_t* al){
+    if (n == 0 || n > THERM_ALINEADO_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // b[k] y b[k+1] delimitan la conversión k; una sola lectura del reloj entre conversiones
+    int64_t b[2 * THERM_ALINEADO_MAX + 1];
+    int raw[2 * THERM_ALINEADO_MAX];
+    b[0] = esp_timer_get_time();
+    for (size_t k = 0; k < 2 * n; k++) {
+        size_t c = (k < n) ? k : 2 * n - 1 - k;
+        esp_err_t ret = backend->read(thermistors[c].adc_unit, thermistors[c].adc_channel, &raw[k]);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        b[k + 1] = esp_timer_get_time();
+    }
+
+    // Instantes en medios us desde b[0]: el punto medio de la conversión k es (b[k] + b[k+1]) / 2
+    int64_t t0 = 0;
+    for (size_t k = 0; k < 2 * n; k++) {
+        t0 += b[k] + b[k + 1] - 2 * b[0];
+    }
+    t0 /= 2 * (int64_t) n;
+
+    int64_t cmin = INT64_MAX, cmax = INT64_MIN;
+    for (size_t c = 0; c < n; c++) {
+        size_t kr = 2 * n - 1 - c;
+        int64_t tf = b[c] + b[c + 1] - 2 * b[0];
+        int64_t tr = b[kr] + b[kr + 1] - 2 * b[0];
+        int32_t xf = raw[c];
+        int32_t xr = raw[kr];
+        int64_t centro = (tf + tr) / 2;
+        if (centro < cmin) cmin = centro;
+        if (centro > cmax) cmax = centro;
+
+        int32_t x;
+        if (interpolar && tr > tf) {
+            // Recta por (tf, xf) y (tr, xr) evaluada en t0, redondeando
+            int64_t num = (int64_t) (xr - xf) * (t0 - tf);
+            int64_t den = tr - tf;
+            x = xf + (int32_t) ((num >= 0 ? num + den / 2 : num - den / 2) / den);
+        } else {
+            x = (xf + xr + 1) / 2;
+        }
+        lsb[c] = (x < 0) ? 0 : (x > THERM_LSB_MAX) ? THERM_LSB_MAX : x;
+    }
+
+    if (al != NULL) {
+        al->t_us = (uint32_t) (b[0] + t0 / 2);
+        al->sesgo_us = (uint32_t) ((b[n - 1] + b[n] - b[0] - b[1]) / 2);
+        al->espejo_us = (uint32_t) ((cmax - cmin) / 2);
+    }
+    return ESP_OK;
+}
+
+float convert_lsb_t_formula(uint16_t lsb_value){
     float v = ((lsb_value) * 3.3f / 4095.0f);
     float r_ntc = SERIES_RESISTANCE * (3.3 - v) / v;
     float t_kelvin = 1.0f / (1.0f / NOMINAL_TEMPERATURE + (1.0f / BETA_COEFFICIENT) * log(r_ntc / NOMINAL_RESISTANCE));
@@ -89,8 +220,82 @@ float convert_lsb_t(uint16_t lsb_value){
     return(t_kelvin - 273.15f);
 }
 
+// Tablas de conversión. La de punto fijo ocupa ~0.5 KB. La de float tiene una
+// entrada por cada valor del ADC (16 KB) y reproduce la fórmula exactamente;
+// ningún camino caliente la usa, así que solo se construye para los benchmarks.
+// Punto fijo: 256 tramos cubren 0..4095 con 257 entradas. La última vale la
+// temperatura de THERM_LSB_MAX (4096 está fuera de escala), así que el último
+// tramo mide 15 LSB y no 16: convert_lsb_cdeg lo interpola aparte.
+#define THERM_LUT_FX_ULTIMO ((THERM_LSB_MAX >> THERM_LUT_FX_SHIFT) << THERM_LUT_FX_SHIFT)
+#define THERM_LUT_FX_SIZE ((THERM_LSB_MAX >> THERM_LUT_FX_SHIFT) + 2)
+#define THERM_LUT_FLOAT BENCH_ENABLE
+#if THERM_LUT_FLOAT
+static float therm_lut[THERM_LUT_SIZE];
+#endif
+static int16_t therm_lut_fx[THERM_LUT_FX_SIZE];
+static bool therm_lut_ready = false;
+
+static int16_t therm_to_cdeg(float t){
+    float cdeg = t * 100.0f;
+    // En los extremos de la escala la fórmula se dispara (ADC saturado o en circuito abierto)
+    if (cdeg > INT16_MAX) return INT16_MAX;
+    if (cdeg < INT16_MIN) return INT16_MIN;
+    return (int16_t) lroundf(cdeg);
+}
+
+esp_err_t therm_lut_init(void){
+    if (therm_lut_ready) {
+        return ESP_OK;
+    }
+#if THERM_LUT_FLOAT
+    for (int lsb = 0; lsb < THERM_LUT_SIZE; lsb++) {
+        therm_lut[lsb] = convert_lsb_t_formula(lsb);
+    }
+#endif
+    for (int i = 0; i < THERM_LUT_FX_SIZE; i++) {
+        int lsb = i << THERM_LUT_FX_SHIFT;
+        therm_lut_fx[i] = therm_to_cdeg(convert_lsb_t_formula(lsb > THERM_LSB_MAX ? THERM_LSB_MAX : lsb));
+    }
+    therm_lut_ready = true;
+    return ESP_OK;
+}
+
+float convert_lsb_t(uint16_t lsb_value){
+    if (therm_lut_ready) {
+#if THERM_LUT_FLOAT
+        return therm_lut[lsb_value & THERM_LSB_MAX];
+#else
+        return convert_lsb_cdeg(lsb_value) / 100.0f;
+#endif
+    }
+    return convert_lsb_t_formula(lsb_value);
+}
+
+size_t therm_lut_bytes(void){
+#if THERM_LUT_FLOAT
+    return sizeof(therm_lut) + sizeof(therm_lut_fx);
+#else
+    return sizeof(therm_lut_fx);
+#endif
+}
+
+int16_t convert_lsb_cdeg(uint16_t lsb_value){
+    if (!therm_lut_ready) {
+        return therm_to_cdeg(convert_lsb_t_formula(lsb_value));
+    }
+    lsb_value &= THERM_LSB_MAX;
+    int i = lsb_value >> THERM_LUT_FX_SHIFT;
+    int frac = lsb_value & ((1 << THERM_LUT_FX_SHIFT) - 1);
+    int a = therm_lut_fx[i];
+    int b = therm_lut_fx[i + 1];
+    if (lsb_value >= THERM_LUT_FX_ULTIMO) {
+        return a + (b - a) * frac / (THERM_LSB_MAX - THERM_LUT_FX_ULTIMO);
+    }
+    return a + (((b - a) * frac) >> THERM_LUT_FX_SHIFT);
+}
+
 uint16_t therm_read_lsb(therm_t t1){
     int raw_value = 0;
-    ESP_ERROR_CHECK(adc_oneshot_read(adc_hdlr, t1.adc_channel, &raw_value));
+    ESP_ERROR_CHECK(backend->read(t1.adc_unit, t1.adc_channel, &raw_value));
     return raw_value;
 }
@@ -0,0 +1,210 @@
+// Adquisición continua de los termistores. En el ESP32 usa el ADC en modo
+// continuo: el controlador digital recorre la tabla de patrones y vuelca las
+// conversiones por DMA, de modo que la CPU solo despierta una vez por trama.
+// Con otro backend (simulación, target linux) se generan las tramas leyendo
+// del backend al mismo ritmo, para que la tarea sensor funcione igual.
+#include <esp_err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "term.h"
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_attr.h>
+#include <esp_adc/adc_continuous.h>
+#endif
+
+static const char *TAG = "STF_P1:term_cont";
+
+static therm_chan_t cont_channels[THERM_CONT_MAX_CHANNELS];
+static size_t cont_n = 0;
+static uint32_t cont_freq = 0;
+static volatile uint32_t cont_ovf = 0;
+
+// Modo simulado: instante (us) en que debe estar lista la siguiente trama
+static int64_t cont_due_us = 0;
+
+#if !CONFIG_IDF_TARGET_LINUX
+static adc_continuous_handle_t cont_hdlr = NULL;
+static uint8_t* cont_buf = NULL;
+static uint32_t cont_frame_bytes = 0;
+
+// Desentrelazado: cada resultado DMA trae su canal. Una muestra está completa
+// cuando todos los canales se han convertido desde la anterior.
+static int8_t cont_slot[THERM_SIM_MAX_CHANNELS]; // canal ADC -> posición en cont_channels
+static uint16_t cont_partial[THERM_CONT_MAX_CHANNELS];
+static uint32_t cont_have = 0;
+
+static bool IRAM_ATTR cont_on_pool_ovf(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    cont_ovf++;
+    return false;
+}
+
+static esp_err_t cont_dma_start(void)
+{
+    cont_frame_bytes = THERM_CONT_FRAME_SAMPLES * cont_n * SOC_ADC_DIGI_RESULT_BYTES;
+    cont_buf = malloc(cont_frame_bytes);
+    if (cont_buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = 4 * cont_frame_bytes, // margen de 4 tramas si la tarea se retrasa
+        .conv_frame_size = cont_frame_bytes,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &cont_hdlr));
+
+    // Tabla de patrones: un paso por termistor, mismo ajuste que en oneshot
+    adc_digi_pattern_config_t pattern[THERM_CONT_MAX_CHANNELS] = {0};
+    memset(cont_slot, -1, sizeof(cont_slot));
+    for (size_t c = 0; c < cont_n; c++) {
+        pattern[c].atten = THERM_ADC_ATTEN;
+        pattern[c].channel = cont_channels[c].channel;
+        pattern[c].unit = ADC_UNIT_1;
+        pattern[c].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        cont_slot[cont_channels[c].channel] = c;
+    }
+    cont_have = 0;
+
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = cont_n,
+        .adc_pattern = pattern,
+        .sample_freq_hz = cont_freq,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(cont_hdlr, &dig_cfg));
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_pool_ovf = cont_on_pool_ovf,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(cont_hdlr, &cbs, NULL));
+    return adc_continuous_start(cont_hdlr);
+}
+
+static size_t cont_dma_read(uint16_t* lsb, size_t max_samples, uint32_t timeout_ms)
+{
+    uint32_t bytes = 0;
+    size_t out = 0;
+
+    // adc_continuous_read bloquea la tarea hasta que el driver tiene una trama
+    if (adc_continuous_read(cont_hdlr, cont_buf, cont_frame_bytes, &bytes, timeout_ms) != ESP_OK) {
+        return 0;
+    }
+
+    const uint32_t all = (1u << cont_n) - 1;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= bytes && out < max_samples; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t*) &cont_buf[i];
+        uint32_t ch = p->type1.channel;
+        if (ch >= THERM_SIM_MAX_CHANNELS || cont_slot[ch] < 0) {
+            continue;
+        }
+        cont_partial[cont_slot[ch]] = p->type1.data;
+        cont_have |= 1u << cont_slot[ch];
+        if (cont_have == all) {
+            memcpy(&lsb[out * cont_n], cont_partial, cont_n * sizeof(uint16_t));
+            out++;
+            cont_have = 0;
+        }
+    }
+    return out;
+}
+#endif
+
+esp_err_t therm_cont_start(const therm_chan_t* channels, size_t nchannels, uint32_t sample_freq_hz)
+{
+    if (nchannels == 0 || nchannels > THERM_CONT_MAX_CHANNELS || sample_freq_hz == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(cont_channels, channels, nchannels * sizeof(therm_chan_t));
+    cont_n = nchannels;
+    cont_freq = sample_freq_hz;
+    cont_ovf = 0;
+
+#if !CONFIG_IDF_TARGET_LINUX
+    if (therm_get_backend() == &therm_backend_adc) {
+        for (size_t c = 0; c < cont_n; c++) {
+            if (cont_channels[c].unit != ADC_UNIT_1) {
+                cont_n = 0;
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+        // El controlador digital tiene un rango de frecuencias limitado (>= 20 kHz en el ESP32)
+        if (cont_freq < SOC_ADC_SAMPLE_FREQ_THRES_LOW) cont_freq = SOC_ADC_SAMPLE_FREQ_THRES_LOW;
+        if (cont_freq > SOC_ADC_SAMPLE_FREQ_THRES_HIGH) cont_freq = SOC_ADC_SAMPLE_FREQ_THRES_HIGH;
+        ESP_LOGI(TAG, "ADC continuo: %u canales a %u conv/s", (unsigned) cont_n, (unsigned) cont_freq);
+        return cont_dma_start();
+    }
+#endif
+
+    for (size_t c = 0; c < cont_n; c++) {
+        ESP_ERROR_CHECK(therm_get_backend()->config(cont_channels[c].unit, cont_channels[c].channel));
+    }
+    cont_due_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "ADC continuo (%s): %u canales a %u conv/s", therm_get_backend()->name,
+             (unsigned) cont_n, (unsigned) cont_freq);
+    return ESP_OK;
+}
+
+size_t therm_cont_read(uint16_t* lsb, size_t max_samples, uint32_t timeout_ms)
+{
+    if (cont_n == 0) {
+        return 0;
+    }
+#if !CONFIG_IDF_TARGET_LINUX
+    if (cont_hdlr != NULL) {
+        return cont_dma_read(lsb, max_samples, timeout_ms);
+    }
+#endif
+
+    // Simulación: una trama de THERM_CONT_FRAME_SAMPLES muestras, entregada
+    // cuando le tocaría al ADC real a la frecuencia configurada
+    size_t n = (max_samples < THERM_CONT_FRAME_SAMPLES) ? max_samples : THERM_CONT_FRAME_SAMPLES;
+    int64_t due_us = cont_due_us + (int64_t) n * cont_n * 1000000 / cont_freq;
+    int64_t wait_us = due_us - esp_timer_get_time();
+    if (wait_us > (int64_t) timeout_ms * 1000) {
+        vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+        return 0;
+    }
+    if (wait_us >= portTICK_PERIOD_MS * 1000) {
+        vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+    }
+    cont_due_us = due_us;
+
+    const therm_backend_t* backend = therm_get_backend();
+    for (size_t i = 0; i < n; i++) {
+        for (size_t c = 0; c < cont_n; c++) {
+            int raw = 0;
+            backend->read(cont_channels[c].unit, cont_channels[c].channel, &raw);
+            lsb[i * cont_n + c] = raw;
+        }
+    }
+    return n;
+}
+
+esp_err_t therm_cont_stop(void)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    if (cont_hdlr != NULL) {
+        ESP_ERROR_CHECK(adc_continuous_stop(cont_hdlr));
+        ESP_ERROR_CHECK(adc_continuous_deinit(cont_hdlr));
+        cont_hdlr = NULL;
+        free(cont_buf);
+        cont_buf = NULL;
+    }
+#endif
+    cont_n = 0;
+    return ESP_OK;
+}
+
+uint32_t therm_cont_overflows(void)
+{
+    return cont_ovf;
+}
+
+uint32_t therm_cont_freq(void)
+{
+    return cont_freq;
+}
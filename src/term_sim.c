@@ -0,0 +1,179 @@
+// Backend simulado del termistor. Sustituye al ADC oneshot para poder ejecutar
+// la cadena sensor -> votador -> monitor en el target linux de ESP-IDF (o en el
+// propio ESP32 sin termistores conectados) a frecuencias de muestreo arbitrarias.
+#include <esp_err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "term.h"
+
+static const char *TAG = "STF_P1:term_sim";
+
+// Estado de cada canal simulado
+typedef struct {
+    uint16_t* trace;  // traza a reproducir (NULL = señal sintética)
+    size_t len;
+    size_t pos;       // siguiente muestra a devolver
+    uint32_t k;       // contador de muestras de la señal sintética
+}sim_channel_t;
+
+static sim_channel_t channels[THERM_ADC_UNITS][THERM_SIM_MAX_CHANNELS];
+
+static sim_channel_t* sim_channel(adc_unit_t unit, adc_channel_t channel) {
+    if (unit >= THERM_ADC_UNITS || channel >= THERM_SIM_MAX_CHANNELS) {
+        return NULL;
+    }
+    return &channels[unit][channel];
+}
+
+// Parámetros de la señal sintética. Por defecto ~25°C (mitad de escala) con
+// una oscilación lenta y algo de ruido, parecido a lo que entrega el ADC real.
+static uint16_t syn_base = 2048;
+static uint16_t syn_amplitude = 200;
+static uint16_t syn_noise = 4;
+static uint32_t syn_period = 1000;
+static uint32_t syn_seed = 1;
+
+// Generador congruencial: barato y reproducible entre ejecuciones
+static uint32_t sim_rand(void) {
+    syn_seed = syn_seed * 1664525u + 1013904223u;
+    return syn_seed >> 8;
+}
+
+static uint16_t sim_synthetic(sim_channel_t* ch) {
+    float phase = 2.0f * (float) M_PI * (float) (ch->k++ % syn_period) / (float) syn_period;
+    int value = syn_base + (int) (syn_amplitude * sinf(phase));
+    if (syn_noise) {
+        value += (int) (sim_rand() % (2u * syn_noise + 1u)) - syn_noise;
+    }
+    if (value < 0) value = 0;
+    if (value > 4095) value = 4095;
+    return value;
+}
+
+static esp_err_t sim_init(void) {
+    ESP_LOGI(TAG, "ADC simulado (%s)", channels[0][0].trace ? "traza" : "sintético");
+    return ESP_OK;
+}
+
+static esp_err_t sim_config(adc_unit_t unit, adc_channel_t channel) {
+    sim_channel_t* ch = sim_channel(unit, channel);
+    if (ch == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ch->pos = 0;
+    ch->k = 0;
+    return ESP_OK;
+}
+
+static esp_err_t sim_read(adc_unit_t unit, adc_channel_t channel, int* raw) {
+    sim_channel_t* ch = sim_channel(unit, channel);
+    if (ch == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ch->trace != NULL) {
+        *raw = ch->trace[ch->pos];
+        ch->pos = (ch->pos + 1) % ch->len;
+    } else {
+        *raw = sim_synthetic(ch);
+    }
+    return ESP_OK;
+}
+
+const therm_backend_t therm_backend_sim = {
+    .name = "sim",
+    .init = sim_init,
+    .config = sim_config,
+    .read = sim_read,
+};
+
+esp_err_t therm_sim_set_synthetic(uint16_t base, uint16_t amplitude, uint16_t noise, uint32_t period) {
+    if (base > 4095 || period == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    syn_base = base;
+    syn_amplitude = amplitude;
+    syn_noise = noise;
+    syn_period = period;
+    return ESP_OK;
+}
+
+esp_err_t therm_sim_load_trace(therm_chan_t chan, const uint16_t* trace, size_t len) {
+    sim_channel_t* ch = sim_channel(chan.unit, chan.channel);
+    if (ch == NULL || (trace != NULL && len == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    free(ch->trace);
+    ch->trace = NULL;
+    ch->len = 0;
+    ch->pos = 0;
+    if (trace == NULL) {
+        return ESP_OK; // vuelve a la señal sintética
+    }
+    ch->trace = malloc(len * sizeof(uint16_t));
+    if (ch->trace == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(ch->trace, trace, len * sizeof(uint16_t));
+    ch->len = len;
+    return ESP_OK;
+}
+
+esp_err_t therm_sim_load_csv(const char* path, const therm_chan_t* chans, size_t nchannels) {
+    if (nchannels == 0 || nchannels > THERM_ADC_UNITS * THERM_SIM_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        ESP_LOGW(TAG, "No se puede abrir la traza %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint16_t* cols[THERM_ADC_UNITS * THERM_SIM_MAX_CHANNELS] = {0};
+    size_t len = 0;
+    size_t cap = 0;
+    char line[256];
+    esp_err_t ret = ESP_OK;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // Las líneas que no empiezan por un número (cabecera, comentarios) se ignoran
+        if (line[0] < '0' || line[0] > '9') {
+            continue;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 256;
+            for (size_t c = 0; c < nchannels; c++) {
+                uint16_t* tmp = realloc(cols[c], cap * sizeof(uint16_t));
+                if (tmp == NULL) {
+                    ret = ESP_ERR_NO_MEM;
+                    goto out;
+                }
+                cols[c] = tmp;
+            }
+        }
+        char* p = line;
+        for (size_t c = 0; c < nchannels; c++) {
+            long v = strtol(p, &p, 10);
+            cols[c][len] = (v < 0) ? 0 : (v > 4095) ? 4095 : v;
+            if (*p == ',' || *p == ';') p++;
+        }
+        len++;
+    }
+
+    if (len == 0) {
+        ret = ESP_ERR_INVALID_SIZE;
+        goto out;
+    }
+    for (size_t c = 0; c < nchannels && ret == ESP_OK; c++) {
+        ret = therm_sim_load_trace(chans[c], cols[c], len);
+    }
+    ESP_LOGI(TAG, "Traza %s: %u muestras x %u canales", path, (unsigned) len, (unsigned) nchannels);
+
+out:
+    for (size_t c = 0; c < nchannels; c++) {
+        free(cols[c]);
+    }
+    fclose(f);
+    return ret;
+}
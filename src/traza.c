@@ -0,0 +1,154 @@
+// Trazas de latencia por etapa (ver traza.h)
+#include <string.h>
+#include <stdatomic.h>
+
+#include <esp_log.h>
+
+#include "config.h"
+#include "traza.h"
+
+static const char *TAG = "STF_P1:traza";
+
+static const char *nombres[TRAZA_NUM_ETAPAS] = {
+	"adquisicion", "sensor->votador", "votador->monitor", "total"
+};
+
+static traza_hist_t etapas[TRAZA_NUM_ETAPAS];
+static uint32_t perdidos = 0;
+static uint32_t desordenados = 0;
+static uint16_t ultimo_seq = 0;
+static bool primero = true;
+static atomic_bool volcado_pedido = false;
+
+// Índice de cubeta: los valores 0..3 van directos; a partir de ahí, 4 cubetas
+// por potencia de 2 según los dos bits siguientes al más significativo
+static int traza_cubeta(uint32_t v)
+{
+	if (v < 4)
+	{
+		return v;
+	}
+	int e = 31 - __builtin_clz(v);
+	return (e - 1) * 4 + ((v >> (e - 2)) & 3);
+}
+
+// Límite inferior de una cubeta (inversa de traza_cubeta)
+static uint32_t traza_cubeta_min(int i)
+{
+	if (i < 4)
+	{
+		return i;
+	}
+	int e = i / 4 + 1;
+	return (uint32_t) (4 + i % 4) << (e - 2);
+}
+
+void traza_hist_add(traza_hist_t *h, uint32_t v)
+{
+	if (h->n == 0 || v < h->min) h->min = v;
+	if (v > h->max) h->max = v;
+	h->n++;
+	h->suma += v;
+	h->cubetas[traza_cubeta(v)]++;
+}
+
+void traza_reset(void)
+{
+	memset(etapas, 0, sizeof(etapas));
+	perdidos = 0;
+	desordenados = 0;
+	primero = true;
+}
+
+void traza_registrar(const mensaje *msg, uint32_t ahora_us)
+{
+	// Secuencia: un salto hacia delante son mensajes perdidos por el camino
+	// (buffer lleno en el sensor o en el votador); uno hacia atrás, un desorden
+	int16_t salto = (int16_t) (msg->seq - (uint16_t) (ultimo_seq + 1));
+	if (primero)
+	{
+		primero = false;
+		ultimo_seq = msg->seq;
+	}
+	else if (salto >= 0)
+	{
+		perdidos += salto;
+		ultimo_seq = msg->seq;
+	}
+	else
+	{
+		desordenados++;
+	}
+
+#if TRAZA_ENABLE
+	// Restas en 32 bits: correctas aunque el contador de esp_timer dé la vuelta
+	traza_hist_add(&etapas[TRAZA_ADQUISICION], msg->ts_envio_us - msg->ts_us);
+	traza_hist_add(&etapas[TRAZA_SENSOR_VOTADOR], msg->ts_voto_us - msg->ts_envio_us);
+	traza_hist_add(&etapas[TRAZA_VOTADOR_MONITOR], ahora_us - msg->ts_voto_us);
+#endif
+	traza_hist_add(&etapas[TRAZA_TOTAL], ahora_us - msg->ts_us);
+}
+
+uint32_t traza_percentil(const traza_hist_t *h, float p)
+{
+	if (h->n == 0)
+	{
+		return 0;
+	}
+	uint32_t objetivo = (uint32_t) (p * h->n);
+	uint32_t acumulado = 0;
+	for (int i = 0; i < TRAZA_CUBETAS; i++)
+	{
+		acumulado += h->cubetas[i];
+		if (acumulado > objetivo)
+		{
+			// Límite superior de la cubeta, acotado por el máximo observado
+			uint32_t sup = (i + 1 < TRAZA_CUBETAS) ? traza_cubeta_min(i + 1) - 1 : h->max;
+			return (sup < h->max) ? sup : h->max;
+		}
+	}
+	return h->max;
+}
+
+void traza_volcar(void)
+{
+	atomic_store(&volcado_pedido, false);
+	ESP_LOGI(TAG, "Latencias (us): perdidos %u, desordenados %u",
+			 (unsigned) perdidos, (unsigned) desordenados);
+	for (int e = 0; e < TRAZA_NUM_ETAPAS; e++)
+	{
+		const traza_hist_t *h = &etapas[e];
+		if (h->n == 0)
+		{
+			continue;
+		}
+		ESP_LOGI(TAG, "  %-17s n %u; min %u; p50 %u; p99 %u; max %u; media %u", nombres[e],
+				 (unsigned) h->n, (unsigned) h->min, (unsigned) traza_percentil(h, 0.50f),
+				 (unsigned) traza_percentil(h, 0.99f), (unsigned) h->max, (unsigned) (h->suma / h->n));
+	}
+}
+
+void traza_solicitar_volcado(void)
+{
+	atomic_store(&volcado_pedido, true);
+}
+
+bool traza_volcado_pendiente(void)
+{
+	return atomic_load(&volcado_pedido);
+}
+
+const traza_hist_t *traza_etapa(traza_etapa_t etapa)
+{
+	return &etapas[etapa];
+}
+
+uint32_t traza_perdidos(void)
+{
+	return perdidos;
+}
+
+uint32_t traza_desordenados(void)
+{
+	return desordenados;
+}
@@ -0,0 +1,283 @@
+// Núcleo de votación N-modular (ver votador.h)
+#include <string.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "votador.h"
+#include "calibracion.h"
+
+static _Atomic uint32_t fallidos = 0;
+
+// Canales en fallo a partir de las discrepancias de los 16 bits bajos de cada palabra
+#define FALLOS16(da, db, dc) ((((da) & 0xFFFF) != 0) | ((((db) & 0xFFFF) != 0) << 1) | ((((dc) & 0xFFFF) != 0) << 2))
+
+// Sustituye en fallos los bits del grupo g
+static inline void votador_fallos_grupo(mensaje *m, int g, uint32_t f)
+{
+	m->fallos = (m->fallos & ~VOTADOR_FALLOS_GRUPO(g)) | (therm_mapa_t) (f << (g * SENSORES_GRUPO));
+}
+
+// Tres sensores: dos muestras por palabra de 32 bits
+static void votador_tmr3(const mensaje *in, mensaje *out, size_t n, int g, uint16_t mask, votador_resumen_t *res)
+{
+	const int base = g * SENSORES_GRUPO;
+	const uint32_t m2 = (uint32_t) mask | ((uint32_t) mask << 16);
+	uint32_t bits_a = 0, bits_b = 0, bits_c = 0;
+	uint32_t disc_a = 0, disc_b = 0, disc_c = 0;
+	uint8_t fallos = 0;
+	size_t i = 0;
+
+	// Dos muestras por iteración: la muestra i en los 16 bits bajos y la i+1 en los altos
+	for (; i + 1 < n; i += 2)
+	{
+		uint32_t a = in[i].lsb[base] | ((uint32_t) in[i + 1].lsb[base] << 16);
+		uint32_t b = in[i].lsb[base + 1] | ((uint32_t) in[i + 1].lsb[base + 1] << 16);
+		uint32_t c = in[i].lsb[base + 2] | ((uint32_t) in[i + 1].lsb[base + 2] << 16);
+
+		uint32_t r = (a & b) | (b & c) | (a & c);
+		uint32_t da = a ^ r;
+		uint32_t db = b ^ r;
+		uint32_t dc = c ^ r;
+		bits_a |= da;
+		bits_b |= db;
+		bits_c |= dc;
+		da &= m2;
+		db &= m2;
+		dc &= m2;
+
+		uint8_t f0 = FALLOS16(da, db, dc);
+		uint8_t f1 = FALLOS16(da >> 16, db >> 16, dc >> 16);
+		out[i].media_raw[g] = (uint16_t) r;
+		votador_fallos_grupo(&out[i], g, f0);
+		out[i + 1].media_raw[g] = (uint16_t) (r >> 16);
+		votador_fallos_grupo(&out[i + 1], g, f1);
+
+		fallos |= f0 | f1;
+		disc_a += (f0 & 1) + (f1 & 1);
+		disc_b += ((f0 >> 1) & 1) + ((f1 >> 1) & 1);
+		disc_c += ((f0 >> 2) & 1) + ((f1 >> 2) & 1);
+	}
+
+	// Muestra suelta si n es impar
+	if (i < n)
+	{
+		uint32_t a = in[i].lsb[base];
+		uint32_t b = in[i].lsb[base + 1];
+		uint32_t c = in[i].lsb[base + 2];
+		uint32_t r = (a & b) | (b & c) | (a & c);
+		uint32_t da = a ^ r;
+		uint32_t db = b ^ r;
+		uint32_t dc = c ^ r;
+		bits_a |= da;
+		bits_b |= db;
+		bits_c |= dc;
+
+		uint8_t f0 = FALLOS16(da & mask, db & mask, dc & mask);
+		out[i].media_raw[g] = (uint16_t) r;
+		votador_fallos_grupo(&out[i], g, f0);
+		fallos |= f0;
+		disc_a += f0 & 1;
+		disc_b += (f0 >> 1) & 1;
+		disc_c += (f0 >> 2) & 1;
+	}
+
+	res->discrepancias[base] += disc_a;
+	res->discrepancias[base + 1] += disc_b;
+	res->discrepancias[base + 2] += disc_c;
+	res->bits[base] |= (uint16_t) (bits_a | (bits_a >> 16));
+	res->bits[base + 1] |= (uint16_t) (bits_b | (bits_b >> 16));
+	res->bits[base + 2] |= (uint16_t) (bits_c | (bits_c >> 16));
+	res->fallos |= (therm_mapa_t) ((uint32_t) fallos << base);
+}
+
+// N sensores: un bit de la mayoría vale 1 si lo tienen al menos VOTADOR_MAYORIA
+static void votador_tmrn(const mensaje *in, mensaje *out, size_t n, int g, uint16_t mask, votador_resumen_t *res)
+{
+	const int base = g * SENSORES_GRUPO;
+	for (size_t i = 0; i < n; i++)
+	{
+		const uint16_t *v = &in[i].lsb[base];
+		uint32_t r = 0;
+		for (int b = 0; b < 16; b++)
+		{
+			int unos = 0;
+			for (int s = 0; s < SENSORES_GRUPO; s++)
+			{
+				unos += (v[s] >> b) & 1;
+			}
+			r |= (uint32_t) (unos >= VOTADOR_MAYORIA) << b;
+		}
+
+		uint32_t f = 0;
+		for (int s = 0; s < SENSORES_GRUPO; s++)
+		{
+			uint32_t d = v[s] ^ r;
+			res->bits[base + s] |= (uint16_t) d;
+			if (d & mask)
+			{
+				f |= 1u << s;
+				res->discrepancias[base + s]++;
+			}
+		}
+		out[i].media_raw[g] = (uint16_t) r;
+		votador_fallos_grupo(&out[i], g, f);
+		res->fallos |= (therm_mapa_t) (f << base);
+	}
+}
+
+void votador_tmr(const mensaje *in, mensaje *out, size_t n, int g, uint16_t mask, votador_resumen_t *res)
+{
+	if (SENSORES_GRUPO == 3)
+	{
+		votador_tmr3(in, out, n, g, mask, res);
+	}
+	else
+	{
+		votador_tmrn(in, out, n, g, mask, res);
+	}
+	res->muestras += n;
+}
+
+// min/max/|x| sin saltos, para que el bucle no dependa de los datos
+static inline int32_t vmin(int32_t a, int32_t b) { return b + ((a - b) & ((a - b) >> 31)); }
+static inline int32_t vmax(int32_t a, int32_t b) { return a - ((a - b) & ((a - b) >> 31)); }
+static inline int32_t vabs(int32_t a) { return (a ^ (a >> 31)) - (a >> 31); }
+
+// Tres sensores: sin saltos; un canal se excluye si se aleja de los otros dos
+static void votador_analogico3(const mensaje *in, mensaje *out, size_t n, int g, int por_lsb, uint16_t tol,
+							   votador_resumen_t *res)
+{
+	const int base = g * SENSORES_GRUPO;
+	uint32_t disc_a = 0, disc_b = 0, disc_c = 0;
+	uint8_t fallos = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		int32_t la = in[i].lsb[base];
+		int32_t lb = in[i].lsb[base + 1];
+		int32_t lc = in[i].lsb[base + 2];
+		int32_t ta = calib_cdeg(base, la);
+		int32_t tb = calib_cdeg(base + 1, lb);
+		int32_t tc = calib_cdeg(base + 2, lc);
+
+		// Ventana de tolerancia por pares, en el dominio configurado
+		int32_t xa = por_lsb ? la : ta;
+		int32_t xb = por_lsb ? lb : tb;
+		int32_t xc = por_lsb ? lc : tc;
+		uint32_t ab = vabs(xa - xb) > tol;
+		uint32_t bc = vabs(xb - xc) > tol;
+		uint32_t ac = vabs(xa - xc) > tol;
+
+		// Fuera de la ventana respecto a los otros dos
+		uint32_t fa = ab & ac;
+		uint32_t fb = ab & bc;
+		uint32_t fc = ac & bc;
+		uint8_t f = fa | (fb << 1) | (fc << 2);
+
+		// Mediana de tres, en LSB y en temperatura (cada canal tiene su calibración)
+		int32_t med = vmax(vmin(la, lb), vmin(vmax(la, lb), lc));
+		int32_t tmed = vmax(vmin(ta, tb), vmin(vmax(ta, tb), tc));
+
+		// Media de los canales dentro de la ventana (2 o 3); si no queda ninguno, la mediana
+		int32_t cnt = 3 - (int32_t) (fa + fb + fc);
+		int32_t suma = (ta & ((int32_t) fa - 1)) + (tb & ((int32_t) fb - 1)) + (tc & ((int32_t) fc - 1));
+		out[i].media_cdeg[g] = cnt ? suma / cnt : tmed;
+		out[i].media_raw[g] = med;
+		votador_fallos_grupo(&out[i], g, f);
+
+		fallos |= f;
+		disc_a += fa;
+		disc_b += fb;
+		disc_c += fc;
+	}
+
+	res->discrepancias[base] += disc_a;
+	res->discrepancias[base + 1] += disc_b;
+	res->discrepancias[base + 2] += disc_c;
+	res->fallos |= (therm_mapa_t) ((uint32_t) fallos << base);
+}
+
+// N sensores: mediana por inserción y ventana contra cada uno de los demás
+static void votador_analogicon(const mensaje *in, mensaje *out, size_t n, int g, int por_lsb, uint16_t tol,
+							   votador_resumen_t *res)
+{
+	const int base = g * SENSORES_GRUPO;
+	for (size_t i = 0; i < n; i++)
+	{
+		int32_t l[SENSORES_GRUPO], t[SENSORES_GRUPO], x[SENSORES_GRUPO];
+		int32_t orden[SENSORES_GRUPO], orden_t[SENSORES_GRUPO];
+		for (int s = 0; s < SENSORES_GRUPO; s++)
+		{
+			l[s] = in[i].lsb[base + s];
+			t[s] = calib_cdeg(base + s, l[s]);
+			x[s] = por_lsb ? l[s] : t[s];
+
+			// Inserción ordenada de l[s] y t[s] (cada canal tiene su calibración)
+			int k = s;
+			for (; k > 0 && orden[k - 1] > l[s]; k--)
+			{
+				orden[k] = orden[k - 1];
+			}
+			orden[k] = l[s];
+			for (k = s; k > 0 && orden_t[k - 1] > t[s]; k--)
+			{
+				orden_t[k] = orden_t[k - 1];
+			}
+			orden_t[k] = t[s];
+		}
+		int32_t med = orden[(SENSORES_GRUPO - 1) / 2];
+		int32_t tmed = orden_t[(SENSORES_GRUPO - 1) / 2];
+
+		// Un canal cuenta si coincide con suficientes otros para formar mayoría
+		uint32_t f = 0;
+		int32_t cnt = 0, suma = 0;
+		for (int s = 0; s < SENSORES_GRUPO; s++)
+		{
+			int cerca = 0;
+			for (int o = 0; o < SENSORES_GRUPO; o++)
+			{
+				cerca += (o != s) && vabs(x[s] - x[o]) <= tol;
+			}
+			if (cerca < VOTADOR_MAYORIA - 1)
+			{
+				f |= 1u << s;
+				res->discrepancias[base + s]++;
+			}
+			else
+			{
+				cnt++;
+				suma += t[s];
+			}
+		}
+		out[i].media_cdeg[g] = cnt ? suma / cnt : tmed;
+		out[i].media_raw[g] = med;
+		votador_fallos_grupo(&out[i], g, f);
+		res->fallos |= (therm_mapa_t) (f << base);
+	}
+}
+
+void votador_analogico(const mensaje *in, mensaje *out, size_t n, int g, votador_tol_t unidad, uint16_t tol,
+					   votador_resumen_t *res)
+{
+	const int por_lsb = (unidad == VOTADOR_TOL_LSB);
+	if (SENSORES_GRUPO == 3)
+	{
+		votador_analogico3(in, out, n, g, por_lsb, tol, res);
+	}
+	else
+	{
+		votador_analogicon(in, out, n, g, por_lsb, tol, res);
+	}
+	res->muestras += n;
+}
+
+bool votador_marcar_fallidos(therm_mapa_t fallos)
+{
+	uint32_t antes = atomic_fetch_or(&fallidos, fallos);
+	return (antes | fallos) != antes;
+}
+
+therm_mapa_t votador_sensores_fallidos(void)
+{
+	return (therm_mapa_t) atomic_load(&fallidos);
+}
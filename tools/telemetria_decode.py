@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+"""Decodifica la telemetría binaria del monitor (ver include/telemetria.h) a CSV.
+
+Uso:
+    telemetria_decode.py telemetria.bin > muestras.csv
+    telemetria_decode.py /dev/ttyUSB0 --baudios 115200 > muestras.csv   (requiere pyserial)
+    cat captura.bin | telemetria_decode.py - > muestras.csv
+
+Las tramas con CRC incorrecto (también el texto del log que comparte la UART),
+y los registros delta cuya base no es el último registro decodificado, se
+descartan; al final se resumen en stderr junto con los huecos de secuencia.
+"""
+
+import argparse
+import csv
+import sys
+
+REG_CLAVE = 0x01
+REG_DELTA = 0x02
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("COBS")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def varint(data, pos):
+    v = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise ValueError("varint")
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return v, pos
+        shift += 7
+
+
+def zigzag(data, pos):
+    v, pos = varint(data, pos)
+    return (v >> 1) ^ -(v & 1), pos
+
+
+class Decodificador:
+    def __init__(self):
+        self.anterior = None
+        self.canales = None
+        self.grupos = None
+        self.errores_crc = 0
+        self.sin_clave = 0
+        self.huecos = 0
+        self.ultimo_seq = None
+
+    def descartar(self):
+        # No se sabe si era una trama o texto del log: la referencia de las
+        # diferencias se conserva, y el siguiente delta dice si sigue valiendo
+        self.errores_crc += 1
+
+    def registro(self, reg):
+        if len(reg) < 4 or crc16(reg[:-2]) != reg[-2] | (reg[-1] << 8):
+            self.descartar()
+            return None
+        try:
+            return self.campos(reg[:-2])
+        except (ValueError, IndexError):
+            # CRC correcto pero registro truncado o de otro formato
+            self.descartar()
+            return None
+
+    def campos(self, reg):
+        tipo = reg[0]
+        pos = 1
+        if tipo == REG_CLAVE:
+            canales = reg[pos]
+            grupos = reg[pos + 1]
+            pos += 2
+            base = [0] * (1 + canales + 2 * grupos)
+        elif tipo == REG_DELTA and self.anterior is not None and reg[pos] == self.ultimo_seq & 0xFF:
+            canales, grupos = self.canales, self.grupos
+            base = self.anterior
+            pos += 1
+        else:
+            # Delta sin clave previa o calculado sobre una trama perdida: hasta
+            # la próxima clave no se puede reconstruir
+            self.sin_clave += 1
+            self.anterior = None
+            return None
+
+        seq = reg[pos] | (reg[pos + 1] << 8)
+        pos += 2
+        valores = []
+        for b in base:
+            d, pos = zigzag(reg, pos)
+            valores.append(b + d)
+        valores[0] &= 0xFFFFFFFF  # ts_us en 32 bits
+        fallos, pos = varint(reg, pos)
+        if pos != len(reg):
+            raise ValueError("longitud")
+        self.canales, self.grupos = canales, grupos
+        self.anterior = valores
+
+        if self.ultimo_seq is not None and seq != (self.ultimo_seq + 1) & 0xFFFF:
+            self.huecos += 1
+        self.ultimo_seq = seq
+        return [seq] + valores + [fallos]
+
+
+def tramas(entrada):
+    buf = bytearray()
+    while True:
+        bloque = entrada.read(4096)
+        if not bloque:
+            break
+        buf += bloque
+        while True:
+            fin = buf.find(0)
+            if fin < 0:
+                break
+            trama = bytes(buf[:fin])
+            del buf[:fin + 1]
+            if trama:
+                yield trama
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("entrada", help="fichero, puerto serie o - para stdin")
+    ap.add_argument("--baudios", type=int, default=115200)
+    args = ap.parse_args()
+
+    if args.entrada == "-":
+        entrada = sys.stdin.buffer
+    elif args.entrada.startswith("/dev/") or args.entrada.upper().startswith("COM"):
+        import serial
+        entrada = serial.Serial(args.entrada, args.baudios, timeout=None)
+    else:
+        entrada = open(args.entrada, "rb")
+
+    dec = Decodificador()
+    salida = csv.writer(sys.stdout)
+    cabecera = False
+    n = 0
+    try:
+        for trama in tramas(entrada):
+            try:
+                reg = cobs_decode(trama)
+            except ValueError:
+                dec.descartar()
+                continue
+            fila = dec.registro(reg)
+            if fila is None:
+                continue
+            if not cabecera:
+                medias = ["media_raw", "media_cdeg"]
+                if dec.grupos > 1:
+                    medias = ["%s%d" % (m, g + 1) for g in range(dec.grupos) for m in medias]
+                salida.writerow(["seq", "ts_us"] + ["lsb%d" % (c + 1) for c in range(dec.canales)] +
+                                medias + ["fallos"])
+                cabecera = True
+            salida.writerow(fila)
+            n += 1
+    except KeyboardInterrupt:
+        pass
+
+    print("registros: %d, tramas descartadas: %d, deltas sin clave: %d, huecos de secuencia: %d" %
+          (n, dec.errores_crc, dec.sin_clave, dec.huecos), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()